@@ -10,7 +10,7 @@ from yices_utils import *
 # yices
 from yices import *
 
-def get_bounds(filename, bits=8, dependency=True):
+def get_bounds(filename, bits=8, dependency=True, with_ranges=False):
 
     print("CRN Variable Bound Calculator")
 
@@ -385,5 +385,9 @@ def get_bounds(filename, bits=8, dependency=True):
 
     sorted_species = sort_species(init)
     print("Sorted Species:", sorted_species)
+    if with_ranges:
+        # lowest and highest count each species reaches within the unrolling
+        ranges = {s: (lb_loose[s], ub_loose[s]) for s in init}
+        return sorted_species, ranges
     return sorted_species
 
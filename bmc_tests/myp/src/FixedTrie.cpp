@@ -0,0 +1,45 @@
+#include "FixedTrie.h"
+
+#include <utility>
+
+namespace stamina {
+namespace core {
+namespace vectormap {
+
+namespace {
+	typedef std::unique_ptr<FixedTrieBase> (*FixedTrieFactory)();
+
+	template <uint16_t Depth, typename KeyT>
+	std::unique_ptr<FixedTrieBase>
+	makeFixedTrieOf() {
+		return std::unique_ptr<FixedTrieBase>(new FixedTrie<Depth, KeyT>());
+	}
+
+	// Instantiates the trie for every depth from 1 to MAX_FIXED_DEPTH and
+	// picks the one for `depth`
+	template <typename KeyT, std::size_t... Depths>
+	std::unique_ptr<FixedTrieBase>
+	makeFixedTrieOfDepth(uint16_t depth, std::index_sequence<Depths...>) {
+		static const FixedTrieFactory factories[] = { &makeFixedTrieOf<Depths + 1, KeyT>... };
+		return factories[depth - 1]();
+	}
+}
+
+std::unique_ptr<FixedTrieBase>
+makeFixedTrie(uint16_t depth, uint16_t keyBits) {
+	if (depth == 0 || depth > MAX_FIXED_DEPTH) {
+		return nullptr;
+	}
+	auto const depths = std::make_index_sequence<MAX_FIXED_DEPTH>();
+	if (keyBits <= 8) {
+		return makeFixedTrieOfDepth<uint8_t>(depth, depths);
+	}
+	if (keyBits <= 16) {
+		return makeFixedTrieOfDepth<uint16_t>(depth, depths);
+	}
+	return makeFixedTrieOfDepth<uint32_t>(depth, depths);
+}
+
+} // namespace vectormap
+} // namespace core
+} // namespace stamina
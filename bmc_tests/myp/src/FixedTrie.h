@@ -0,0 +1,276 @@
+#ifndef STAMINA_CORE_VECTORMAP_FIXEDTRIE_H
+#define STAMINA_CORE_VECTORMAP_FIXEDTRIE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "KeySearch.h"
+#include "NodePool.h"
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			// Deepest trie makeFixedTrie() has an instantiation for
+			const uint16_t MAX_FIXED_DEPTH = 32;
+
+			/**
+			 * Interface of the FixedTrie instantiations, so that one can be picked
+			 * at runtime. Keys are decoded states like the ones Trie::decode()
+			 * gives, and must have exactly `depth()` values.
+			 * */
+			class FixedTrieBase {
+			public:
+				virtual ~FixedTrieBase() { /* Intentionally left empty */ }
+				/**
+				 * @param key Key of `depth()` values
+				 * @return The index of the state and whether it was newly inserted
+				 * @throws std::out_of_range If a value does not fit the key type
+				 * of the trie. Nothing is inserted then.
+				 * */
+				virtual std::pair<uint32_t, bool> findOrInsert(const uint32_t * key) = 0;
+				// Returns (uint32_t) -1 if the state is not in the trie
+				virtual uint32_t get(const uint32_t * key) const = 0;
+				virtual uint16_t depth() const = 0;
+				virtual uint32_t getNumberOfStates() const = 0;
+				virtual std::size_t bytesInUse() const = 0;
+			};
+
+			/**
+			 * Trie over keys with a number of levels known at compile time. The
+			 * walk down is unrolled into one step per level, the node layout of
+			 * each level is fixed at compile time, and the last level's slots are
+			 * state indices of type IndexT, so there are no per-node kind or
+			 * length checks.
+			 *
+			 * Nodes are sorted arrays in a NodePool: the child count, the
+			 * capacity, `capacity` keys of type KeyT and then `capacity` slots.
+			 * Mid-sized nodes are searched with the kernels from KeySearch.h.
+			 * With 8-bit keys the root is instead one slot per key value, since
+			 * every lookup goes through it and there is only one of it. The
+			 * layout of a level only depends on the level and the key type:
+			 * picking it from the species ranges of a model, like the Trie does,
+			 * would need an instantiation per combination of layouts, which
+			 * makeFixedTrie() cannot offer for every depth.
+			 *
+			 * @tparam Depth Number of species in a state
+			 * @tparam KeyT Type every species value fits into
+			 * @tparam IndexT Type of the state indices, at most 32 bits
+			 * */
+			template <uint16_t Depth, typename KeyT = uint32_t, typename IndexT = uint32_t>
+			class FixedTrie : public FixedTrieBase {
+				static_assert(Depth > 0, "A trie needs at least one level");
+				static_assert(sizeof(IndexT) <= sizeof(uint32_t), "Indices are kept in 32-bit slots");
+
+			public:
+				FixedTrie()
+					: root(NULL_NODE)
+					, numberOfStates(0)
+				{ /* Intentionally left empty */ }
+
+				std::pair<uint32_t, bool> findOrInsert(const uint32_t * key) override {
+					// A value that does not fit would be stored cut off and then
+					// share its index with another state. The whole key is checked
+					// before anything is inserted.
+					for (uint16_t level = 0; level < Depth; ++level) {
+						if (!fits(key[level])) {
+							throw std::out_of_range("FixedTrie: a key value does not fit the key type");
+						}
+					}
+					return this->template findOrInsertFrom<0>(this->root, key);
+				}
+
+				uint32_t get(const uint32_t * key) const override {
+					if (this->root == NULL_NODE) {
+						return (uint32_t) -1;
+					}
+					const uint32_t * slot = this->template findSlot<0>(this->root, key);
+					return slot ? (IndexT) *slot : (uint32_t) -1;
+				}
+
+				uint16_t depth() const override { return Depth; }
+				uint32_t getNumberOfStates() const override { return this->numberOfStates; }
+				std::size_t bytesInUse() const override { return this->pool.bytesInUse(); }
+
+			private:
+				static const uint32_t HEADER_WORDS = 2;
+
+				static uint32_t keyWords(uint32_t capacity) { return (capacity * sizeof(KeyT) + 3) / 4; }
+				static uint32_t nodeWords(uint32_t capacity) { return HEADER_WORDS + keyWords(capacity) + capacity; }
+				static KeyT * keys(uint32_t * node) { return reinterpret_cast<KeyT *>(node + HEADER_WORDS); }
+				static const KeyT * keys(const uint32_t * node) { return reinterpret_cast<const KeyT *>(node + HEADER_WORDS); }
+				static uint32_t * slots(uint32_t * node) { return node + HEADER_WORDS + keyWords(node[1]); }
+				static const uint32_t * slots(const uint32_t * node) { return node + HEADER_WORDS + keyWords(node[1]); }
+
+				// Levels whose node has one slot per key value, NULL_NODE where
+				// there is no child, instead of a sorted array
+				static constexpr bool isDirect(uint16_t level) {
+					return level == 0 && sizeof(KeyT) == 1;
+				}
+				static const uint32_t DIRECT_SLOTS = 256;
+
+				static bool fits(uint32_t value) {
+					return value <= std::numeric_limits<KeyT>::max();
+				}
+
+				// Position of the first key of a node that is not less than `key`
+				static uint32_t lowerBound(const uint32_t * node, KeyT key) {
+					const KeyT * k = keys(node);
+					uint32_t const count = node[0];
+					if (count <= 4) {
+						uint32_t i = 0;
+						while (i < count && k[i] < key) ++i;
+						return i;
+					}
+					if (count <= 64) {
+						return countKeysBelowFor<KeyT>()(k, count, key);
+					}
+					return std::lower_bound(k, k + count, key) - k;
+				}
+
+				template <uint16_t Level>
+				const uint32_t * findSlot(NodeHandle handle, const uint32_t * key) const {
+					if (!fits(key[Level])) {
+						return nullptr;
+					}
+					const uint32_t * node = this->pool.at(handle);
+					const uint32_t * slot;
+					if constexpr (isDirect(Level)) {
+						slot = node + key[Level];
+						if (*slot == NULL_NODE) {
+							return nullptr;
+						}
+					}
+					else {
+						uint32_t const position = lowerBound(node, (KeyT) key[Level]);
+						if (position == node[0] || keys(node)[position] != (KeyT) key[Level]) {
+							return nullptr;
+						}
+						slot = slots(node) + position;
+					}
+					if constexpr (Level + 1 == Depth) {
+						return slot;
+					}
+					else {
+						return this->template findSlot<Level + 1>(*slot, key);
+					}
+				}
+
+				// `nodeRef` is where the handle of the node for `Level` is kept, so
+				// that it can be updated when the node has to grow
+				template <uint16_t Level>
+				std::pair<uint32_t, bool> findOrInsertFrom(NodeHandle & nodeRef, const uint32_t * key) {
+					if (nodeRef == NULL_NODE) {
+						IndexT index = this->numberOfStates++;
+						nodeRef = this->template createPath<Level>(key, index);
+						return std::make_pair(index, true);
+					}
+					uint32_t * node = this->pool.at(nodeRef);
+					if constexpr (isDirect(Level)) {
+						uint32_t & slot = node[key[Level]];
+						if (slot == NULL_NODE) {
+							IndexT index = this->numberOfStates++;
+							slot = index;
+							if constexpr (Level + 1 < Depth) {
+								slot = this->template createPath<Level + 1>(key, index);
+							}
+							return std::make_pair(index, true);
+						}
+						if constexpr (Level + 1 == Depth) {
+							return std::make_pair((IndexT) slot, false);
+						}
+						else {
+							return this->template findOrInsertFrom<Level + 1>(slot, key);
+						}
+					}
+					uint32_t const position = lowerBound(node, (KeyT) key[Level]);
+					if (position < node[0] && keys(node)[position] == (KeyT) key[Level]) {
+						uint32_t & slot = slots(node)[position];
+						if constexpr (Level + 1 == Depth) {
+							return std::make_pair((IndexT) slot, false);
+						}
+						else {
+							return this->template findOrInsertFrom<Level + 1>(slot, key);
+						}
+					}
+					IndexT index = this->numberOfStates++;
+					uint32_t child = index;
+					if constexpr (Level + 1 < Depth) {
+						child = this->template createPath<Level + 1>(key, index);
+					}
+					nodeRef = this->insertAt(nodeRef, position, (KeyT) key[Level], child);
+					return std::make_pair(index, true);
+				}
+
+				// Builds the single-child nodes for the levels from `Level` on
+				template <uint16_t Level>
+				NodeHandle createPath(const uint32_t * key, IndexT index) {
+					uint32_t child = index;
+					if constexpr (Level + 1 < Depth) {
+						child = this->template createPath<Level + 1>(key, index);
+					}
+					if constexpr (isDirect(Level)) {
+						NodeHandle handle = this->pool.allocate(DIRECT_SLOTS);
+						uint32_t * node = this->pool.at(handle);
+						std::fill(node, node + DIRECT_SLOTS, NULL_NODE);
+						node[key[Level]] = child;
+						return handle;
+					}
+					NodeHandle handle = this->pool.allocate(nodeWords(1));
+					uint32_t * node = this->pool.at(handle);
+					node[0] = 1;
+					node[1] = 1;
+					keys(node)[0] = (KeyT) key[Level];
+					slots(node)[0] = child;
+					return handle;
+				}
+
+				// Puts a child at `position`, moving the node to double its capacity
+				// if it is full. Returns the handle of the node.
+				NodeHandle insertAt(NodeHandle handle, uint32_t position, KeyT key, uint32_t child) {
+					uint32_t * node = this->pool.at(handle);
+					uint32_t const count = node[0];
+					if (count == node[1]) {
+						NodeHandle moved = this->pool.allocate(nodeWords(2 * count));
+						uint32_t * m = this->pool.at(moved);
+						m[0] = count;
+						m[1] = 2 * count;
+						std::copy(keys(node), keys(node) + count, keys(m));
+						std::copy(slots(node), slots(node) + count, slots(m));
+						this->pool.release(handle, nodeWords(count));
+						handle = moved;
+						node = m;
+					}
+					KeyT * k = keys(node);
+					uint32_t * s = slots(node);
+					std::memmove(k + position + 1, k + position, (count - position) * sizeof(KeyT));
+					std::memmove(s + position + 1, s + position, (count - position) * sizeof(uint32_t));
+					k[position] = key;
+					s[position] = child;
+					node[0] = count + 1;
+					return handle;
+				}
+
+				NodeHandle root;
+				uint32_t numberOfStates;
+				NodePool pool;
+			};
+
+			/**
+			 * Creates the FixedTrie for states of `depth` species.
+			 *
+			 * @param depth Number of species, at most `MAX_FIXED_DEPTH`
+			 * @param keyBits Bits the widest species needs. Picks 8, 16 or 32-bit keys.
+			 * @return The trie, or null if there is no instantiation for `depth`
+			 * */
+			std::unique_ptr<FixedTrieBase> makeFixedTrie(uint16_t depth, uint16_t keyBits = 32);
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_FIXEDTRIE_H
@@ -0,0 +1,233 @@
+#include "FrozenTrie.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "Trie.h"
+
+namespace stamina {
+namespace core {
+namespace vectormap {
+
+PackedArray::PackedArray(uint8_t width)
+	: count(0)
+	, width(width)
+	, mask((1ull << width) - 1)
+{
+	assert(width > 0 && width <= 32);
+}
+
+void
+PackedArray::push_back(uint32_t value) {
+	assert((value & this->mask) == value);
+	uint64_t const bit = this->count * this->width;
+	uint64_t const word = bit / 64;
+	uint32_t const shift = bit % 64;
+	if (word == this->words.size()) {
+		this->words.push_back(0);
+	}
+	this->words[word] |= (uint64_t) value << shift;
+	if (shift + this->width > 64) {
+		this->words.push_back((uint64_t) value >> (64 - shift));
+	}
+	++this->count;
+}
+
+uint8_t
+PackedArray::bitsFor(uint32_t value) {
+	return value == 0 ? 1 : 32 - __builtin_clz(value);
+}
+
+SelectBits::SelectBits()
+	: count(0)
+{ /* Intentionally left empty */ }
+
+void
+SelectBits::push_back(bool bit) {
+	if (this->count % 64 == 0) {
+		this->words.push_back(0);
+	}
+	this->words.back() |= (uint64_t) bit << (this->count % 64);
+	++this->count;
+}
+
+void
+SelectBits::finish() {
+	uint32_t const wordsPerBlock = BLOCK_BITS / 64;
+	uint64_t zeros = 0;
+	for (uint64_t word = 0; word < this->words.size(); ++word) {
+		if (word % wordsPerBlock == 0) {
+			this->blockZeros.push_back(zeros);
+		}
+		// Only the bits that were pushed count as zeros
+		uint64_t const valid = this->count - word * 64 >= 64 ? ~0ull : (1ull << (this->count % 64)) - 1;
+		zeros += __builtin_popcountll(~this->words[word] & valid);
+		// The next sampled zero is in this word if it is one of its zeros
+		while ((uint64_t) this->zeroSamples.size() * SAMPLE_RATE < zeros) {
+			this->zeroSamples.push_back(word / wordsPerBlock);
+		}
+	}
+}
+
+uint64_t
+SelectBits::select0(uint64_t rank) const {
+	uint32_t const wordsPerBlock = BLOCK_BITS / 64;
+	uint64_t block = this->zeroSamples[rank / SAMPLE_RATE];
+	while (block + 1 < this->blockZeros.size() && this->blockZeros[block + 1] <= rank) {
+		++block;
+	}
+	rank -= this->blockZeros[block];
+	for (uint64_t word = block * wordsPerBlock; ; ++word) {
+		uint64_t zeros = ~this->words[word];
+		uint32_t const inWord = __builtin_popcountll(zeros);
+		if (rank < inWord) {
+			for (; rank > 0; --rank) {
+				zeros &= zeros - 1;
+			}
+			return word * 64 + __builtin_ctzll(zeros);
+		}
+		rank -= inWord;
+	}
+}
+
+std::size_t
+SelectBits::bytesInUse() const {
+	return this->words.size() * sizeof(uint64_t)
+		+ this->blockZeros.size() * sizeof(uint64_t)
+		+ this->zeroSamples.size() * sizeof(uint32_t);
+}
+
+FrozenTrie::FrozenTrie()
+	: depth(0)
+	, nodeCount(0)
+{ /* Intentionally left empty */ }
+
+FrozenTrie::FrozenTrie(const Trie & trie) : FrozenTrie() {
+	if (trie.root == NULL_NODE) {
+		return;
+	}
+	this->depth = trie.depth;
+	if (trie.ordering) {
+		this->ordering.assign(trie.ordering.get(), trie.ordering.get() + this->depth);
+	}
+
+	// The widest key of every level and the largest index decide the widths
+	std::vector<uint32_t> highest(this->depth, 0);
+	uint32_t highestIndex = 0;
+	trie.forEachState([&](const uint32_t * key, uint16_t length, uint32_t index) {
+		for (uint16_t level = 0; level < length; ++level) {
+			highest[level] = std::max(highest[level], key[level]);
+		}
+		highestIndex = std::max(highestIndex, index);
+	});
+	for (uint16_t level = 0; level < this->depth; ++level) {
+		this->labels.emplace_back(PackedArray::bitsFor(highest[level]));
+	}
+	this->indices = PackedArray(PackedArray::bitsFor(highestIndex));
+
+	// States come in key order, so the nodes of each level come in
+	// breadth first order. A state that first differs from the one before
+	// on `level` adds a child to the last node of that level and a new
+	// node with a single child on every level below it.
+	std::vector<std::vector<uint32_t>> degrees(this->depth);
+	std::vector<uint32_t> previous;
+	degrees[0].push_back(0);
+	trie.forEachState([&](const uint32_t * key, uint16_t length, uint32_t index) {
+		uint16_t level = 0;
+		if (!previous.empty()) {
+			level = std::mismatch(previous.begin(), previous.end(), key).first - previous.begin();
+		}
+		++degrees[level].back();
+		for (uint16_t l = level + 1; l < length; ++l) {
+			degrees[l].push_back(1);
+		}
+		for (uint16_t l = level; l < length; ++l) {
+			this->labels[l].push_back(key[l]);
+		}
+		this->indices.push_back(index);
+		previous.assign(key, key + length);
+	});
+
+	uint64_t edges = 0;
+	for (uint16_t level = 0; level < this->depth; ++level) {
+		this->levelEdges.push_back(edges);
+		edges += this->labels[level].size();
+		for (uint32_t degree : degrees[level]) {
+			for (uint32_t i = 0; i < degree; ++i) {
+				this->shape.push_back(true);
+			}
+			this->shape.push_back(false);
+		}
+		std::vector<uint32_t>().swap(degrees[level]);
+	}
+	this->shape.finish();
+	this->nodeCount = 1 + edges;
+}
+
+uint32_t
+FrozenTrie::get(const uint32_t * key, uint16_t length) const {
+	if (length != this->depth || this->indices.size() == 0) {
+		return (uint32_t) -1;
+	}
+	uint64_t node = 0;
+	uint64_t start = 0;
+	for (uint16_t level = 0; level < length; ++level) {
+		uint64_t const end = this->shape.select0(node);
+		// Every node before this one has its 0 bit before `start`, and every
+		// 1 bit before it is the edge to a node after the root
+		uint64_t const first = start - node - this->levelEdges[level];
+		uint64_t low = first;
+		uint64_t high = first + (end - start);
+		const PackedArray & keys = this->labels[level];
+		while (low < high) {
+			uint64_t const middle = (low + high) / 2;
+			if (keys[middle] < key[level]) {
+				low = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+		if (low == first + (end - start) || keys[low] != key[level]) {
+			return (uint32_t) -1;
+		}
+		if (level + 1 == length) {
+			// The edges of the last level are in key order, like the indices
+			return this->indices[low];
+		}
+		node = this->levelEdges[level] + low + 1;
+		start = this->shape.select0(node - 1) + 1;
+	}
+	return (uint32_t) -1;
+}
+
+bool
+FrozenTrie::contains(const uint32_t * key, uint16_t length) const {
+	return this->get(key, length) != (uint32_t) -1;
+}
+
+uint32_t
+FrozenTrie::get(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) const {
+	assert(stateVector.length() - pos <= MAX_KEY_LENGTH);
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = stateVector.decode(key, pos, this->ordering.empty() ? nullptr : this->ordering.data());
+	return this->get(key, length);
+}
+
+bool
+FrozenTrie::contains(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) const {
+	return this->get(stateVector, pos) != (uint32_t) -1;
+}
+
+std::size_t
+FrozenTrie::bytesInUse() const {
+	std::size_t bytes = this->shape.bytesInUse() + this->indices.bytesInUse();
+	for (auto const & keys : this->labels) {
+		bytes += keys.bytesInUse();
+	}
+	return bytes;
+}
+
+} // namespace vectormap
+} // namespace core
+} // namespace stamina
@@ -0,0 +1,118 @@
+#ifndef STAMINA_CORE_VECTORMAP_FROZENTRIE_H
+#define STAMINA_CORE_VECTORMAP_FROZENTRIE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "IndexableBitVector.h"
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			class Trie;
+
+			/**
+			 * Array of unsigned values of a fixed number of bits each, packed
+			 * into 64-bit words.
+			 * */
+			class PackedArray {
+			public:
+				// @param width Bits per value, from 1 to 32
+				explicit PackedArray(uint8_t width = 32);
+
+				void push_back(uint32_t value);
+				uint32_t operator[](uint64_t position) const {
+					uint64_t const bit = position * this->width;
+					uint64_t const word = bit / 64;
+					uint32_t const shift = bit % 64;
+					uint64_t value = this->words[word] >> shift;
+					if (shift + this->width > 64) {
+						value |= this->words[word + 1] << (64 - shift);
+					}
+					return value & this->mask;
+				}
+				uint64_t size() const { return this->count; }
+				std::size_t bytesInUse() const { return this->words.size() * sizeof(uint64_t); }
+				// Bits needed to store `value`, at least 1
+				static uint8_t bitsFor(uint32_t value);
+
+			private:
+				std::vector<uint64_t> words;
+				uint64_t count;
+				uint8_t width;
+				uint64_t mask;
+			};
+
+			/**
+			 * Bit sequence that finds the position of its k-th zero in about
+			 * constant time, using the position of every `SAMPLE_RATE`-th zero
+			 * and the number of zeros before every block of `BLOCK_BITS` bits.
+			 * */
+			class SelectBits {
+			public:
+				static const uint32_t BLOCK_BITS = 512;
+				static const uint32_t SAMPLE_RATE = 512;
+
+				SelectBits();
+
+				void push_back(bool bit);
+				// Builds the directories. No bits can be added afterwards.
+				void finish();
+				bool operator[](uint64_t position) const { return (this->words[position / 64] >> (position % 64)) & 1; }
+				// Position of the zero with `rank` zeros before it
+				uint64_t select0(uint64_t rank) const;
+				uint64_t size() const { return this->count; }
+				std::size_t bytesInUse() const;
+
+			private:
+				std::vector<uint64_t> words;
+				uint64_t count;
+				std::vector<uint64_t> blockZeros;
+				std::vector<uint32_t> zeroSamples;
+			};
+
+			/**
+			 * Read-only copy of a Trie in a level-order unary degree sequence
+			 * (LOUDS). The nodes are numbered breadth first, and node `i` is
+			 * written as one 1 bit per child followed by a 0 bit, so the children
+			 * of a node are found with a select on the zeros and the whole shape
+			 * costs two bits per node. The key of every edge is kept in a packed
+			 * array per level, with as many bits as the largest key of that level
+			 * needs, and the state indices are packed in key order.
+			 *
+			 * Node kinds, chains and buckets of the Trie are all flattened into
+			 * plain nodes with one edge per key. The frozen trie answers the same
+			 * lookups with the same indices as the Trie it was built from.
+			 * */
+			class FrozenTrie {
+			public:
+				FrozenTrie();
+				// Copies all states of a trie, see Trie::freeze()
+				explicit FrozenTrie(const Trie & trie);
+
+				uint32_t get(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) const;
+				bool contains(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) const;
+				// Same as the versions above, on a key decoded by Trie::decode()
+				uint32_t get(const uint32_t * key, uint16_t length) const;
+				bool contains(const uint32_t * key, uint16_t length) const;
+
+				uint32_t getNumberOfStates() const { return (uint32_t) this->indices.size(); }
+				uint64_t getNodeCount() const { return this->nodeCount; }
+				std::size_t bytesInUse() const;
+
+			private:
+				uint16_t depth;
+				uint64_t nodeCount;
+				std::vector<uint32_t> ordering;
+				// The degree sequence of all nodes above the last level
+				SelectBits shape;
+				// Number of edges above each level, so that an edge number can be
+				// turned into a position in the labels of its level
+				std::vector<uint64_t> levelEdges;
+				std::vector<PackedArray> labels;
+				PackedArray indices;
+			};
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_FROZENTRIE_H
@@ -6,6 +6,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 namespace stamina {
 	namespace core {
@@ -67,6 +69,41 @@ namespace stamina {
 					IndexableBitVector<StateType>::initialized = true;
 				}
 
+				/**
+				 * Gets the range each species can take as declared in the model,
+				 * in the order the species are stored. The lower end is always zero
+				 * so the range holds whether or not the generator stores values as
+				 * offsets from the declared lower bound.
+				 *
+				 * @return One (lowest, highest) pair per species
+				 * */
+				static std::vector<std::pair<uint32_t, uint32_t>> speciesBounds() {
+					uint64_t const widest = (1ull << (IndexableBitVector<StateType>::elementWidth() - 1)) - 1;
+					std::vector<std::pair<uint32_t, uint32_t>> bounds;
+					for (auto const & var : IndexableBitVector<StateType>::variableInformation.integerVariables) {
+						uint64_t const upper = var.upperBound < 0 ? 0 : (uint64_t) var.upperBound;
+						bounds.emplace_back(0, (uint32_t) std::min(upper, widest));
+					}
+					return bounds;
+				}
+
+				/**
+				 * Gets the number of bits the values of each species take, in the
+				 * order the species are stored. This is the bit width the model's
+				 * variable information gives each species, but no more than what
+				 * get() reads.
+				 *
+				 * @return One bit width per species
+				 * */
+				static std::vector<uint16_t> keyBitWidths() {
+					uint16_t const widest = IndexableBitVector<StateType>::elementWidth() - 1;
+					std::vector<uint16_t> widths;
+					for (auto const & var : IndexableBitVector<StateType>::variableInformation.integerVariables) {
+						widths.push_back((uint16_t) std::min<uint64_t>(var.bitWidth, widest));
+					}
+					return widths;
+				}
+
 				/**
 				 * Sets the slice size for the bit vector (i.e., how many *bytes* per element).
 				 * If zero, or `stamina::core::vectormap::USE_ACTUAL_STATE_SIZE`, the IndexableBitVector
@@ -115,15 +152,52 @@ namespace stamina {
 
 				StateType get(uint32_t idx) const {
 					// std::cout << "idx=" << idx << ", sliceSize=" << (int) IndexableBitVector<StateType>::sliceSize << ", this->length=" << this->length() << std::endl;
-					uint16_t bitWidth = IndexableBitVector<StateType>::sliceSize == 0
-										// TODO: do we know they will all be the same width?
-										? IndexableBitVector<StateType>::variableInformation.integerVariables[0].bitWidth
-										: IndexableBitVector<StateType>::sliceSize;
+					uint16_t bitWidth = IndexableBitVector<StateType>::elementWidth();
 					assert(idx < this->length());
 					uint_fast64_t bitOffset = idx * bitWidth;
 					return (StateType) state.getAsInt(bitOffset + 1, bitWidth - 1);
 				}
 
+				/**
+				 * Copies the elements from `first` onwards into a plain buffer. The
+				 * bit width and length are only looked up once, so this is much
+				 * cheaper than calling get() for every element.
+				 *
+				 * @param out Buffer with room for `length() - first` elements
+				 * @param first First element to copy
+				 * @param ordering If not null, `out[i - first]` is element `ordering[i]`.
+				 * Must then hold an entry for every element of the vector.
+				 * @return The number of elements written
+				 * */
+				std::size_t decode(StateType * out, std::size_t first = 0, const uint32_t * ordering = nullptr) const {
+					uint16_t bitWidth = IndexableBitVector<StateType>::elementWidth();
+					std::size_t const length = this->length();
+					for (std::size_t i = first; i < length; ++i) {
+						uint_fast64_t bitOffset = (ordering ? ordering[i] : i) * bitWidth;
+						out[i - first] = (StateType) state.getAsInt(bitOffset + 1, bitWidth - 1);
+					}
+					return length - first;
+				}
+
+				/**
+				 * Writes elements into a state, undoing decode(). Only the bits
+				 * that get() reads are written, the others keep their value.
+				 *
+				 * @param in One value per element
+				 * @param length Number of values
+				 * @param state State to write into, which must already have room
+				 * for `length` elements
+				 * @param ordering If not null, `in[i]` is written to element
+				 * `ordering[i]`, like decode() reads it
+				 * */
+				static void encode(const StateType * in, std::size_t length, CompressedState & state, const uint32_t * ordering = nullptr) {
+					uint16_t bitWidth = IndexableBitVector<StateType>::elementWidth();
+					for (std::size_t i = 0; i < length; ++i) {
+						uint_fast64_t bitOffset = (ordering ? ordering[i] : i) * bitWidth;
+						state.setFromInt(bitOffset + 1, bitWidth - 1, in[i]);
+					}
+				}
+
 				// Allows the for (auto val : myIndexableBitVector) syntax
 				// TODO: handle when empty
 				iterator begin() { return iterator(0, this); }
@@ -186,6 +260,13 @@ namespace stamina {
 				const CompressedState & state;
 
 			private:
+				static uint16_t elementWidth() {
+					return IndexableBitVector<StateType>::sliceSize == 0
+						// TODO: do we know they will all be the same width?
+						? IndexableBitVector<StateType>::variableInformation.integerVariables[0].bitWidth
+						: IndexableBitVector<StateType>::sliceSize;
+				}
+
 				// If zero, uses the size of StateType and only gets the
 				// integer variables
 				inline static uint16_t sliceSize = USE_ACTUAL_STATE_SIZE;
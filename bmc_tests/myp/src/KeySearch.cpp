@@ -0,0 +1,153 @@
+#include "KeySearch.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STAMINA_KEY_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace stamina {
+namespace core {
+namespace vectormap {
+
+namespace {
+	template <typename KeyT>
+	uint32_t
+	countKeysBelowScalar(const KeyT * keys, uint32_t count, KeyT key) {
+		return std::lower_bound(keys, keys + count, key) - keys;
+	}
+
+#ifdef STAMINA_KEY_SEARCH_X86
+	// The vector units only compare signed integers, so both sides get their
+	// sign bit flipped first, which keeps the unsigned order.
+	template <typename KeyT>
+	__attribute__((target("sse2"))) inline __m128i
+	broadcast128(KeyT value) {
+		if constexpr (sizeof(KeyT) == 1) return _mm_set1_epi8((char) (value ^ 0x80));
+		else if constexpr (sizeof(KeyT) == 2) return _mm_set1_epi16((short) (value ^ 0x8000));
+		else return _mm_set1_epi32((int) (value ^ 0x80000000));
+	}
+
+	// All bytes of a lane are set where `needle` is greater than the key
+	template <typename KeyT>
+	__attribute__((target("sse2"))) inline __m128i
+	greater128(__m128i needle, const KeyT * keys) {
+		__m128i const block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys)), broadcast128<KeyT>(0));
+		if constexpr (sizeof(KeyT) == 1) return _mm_cmpgt_epi8(needle, block);
+		else if constexpr (sizeof(KeyT) == 2) return _mm_cmpgt_epi16(needle, block);
+		else return _mm_cmpgt_epi32(needle, block);
+	}
+
+	template <typename KeyT>
+	__attribute__((target("avx2"))) inline __m256i
+	broadcast256(KeyT value) {
+		if constexpr (sizeof(KeyT) == 1) return _mm256_set1_epi8((char) (value ^ 0x80));
+		else if constexpr (sizeof(KeyT) == 2) return _mm256_set1_epi16((short) (value ^ 0x8000));
+		else return _mm256_set1_epi32((int) (value ^ 0x80000000));
+	}
+
+	template <typename KeyT>
+	__attribute__((target("avx2"))) inline __m256i
+	greater256(__m256i needle, const KeyT * keys) {
+		__m256i const block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)), broadcast256<KeyT>(0));
+		if constexpr (sizeof(KeyT) == 1) return _mm256_cmpgt_epi8(needle, block);
+		else if constexpr (sizeof(KeyT) == 2) return _mm256_cmpgt_epi16(needle, block);
+		else return _mm256_cmpgt_epi32(needle, block);
+	}
+
+	// Keys are sorted, so the first block that is not entirely below `key`
+	// holds the answer. The byte mask has sizeof(KeyT) bits per key.
+	template <typename KeyT>
+	__attribute__((target("sse2"))) uint32_t
+	countKeysBelowSse2(const KeyT * keys, uint32_t count, KeyT key) {
+		uint32_t const lanes = 16 / sizeof(KeyT);
+		__m128i const needle = broadcast128<KeyT>(key);
+		uint32_t i = 0;
+		for (; i + lanes <= count; i += lanes) {
+			uint32_t mask = _mm_movemask_epi8(greater128<KeyT>(needle, keys + i));
+			if (mask != 0xFFFF) {
+				return i + __builtin_popcount(mask) / sizeof(KeyT);
+			}
+		}
+		while (i < count && keys[i] < key) ++i;
+		return i;
+	}
+
+	template <typename KeyT>
+	__attribute__((target("avx2"))) uint32_t
+	countKeysBelowAvx2(const KeyT * keys, uint32_t count, KeyT key) {
+		uint32_t const lanes = 32 / sizeof(KeyT);
+		__m256i const needle = broadcast256<KeyT>(key);
+		uint32_t i = 0;
+		for (; i + lanes <= count; i += lanes) {
+			uint32_t mask = _mm256_movemask_epi8(greater256<KeyT>(needle, keys + i));
+			if (mask != 0xFFFFFFFF) {
+				return i + __builtin_popcount(mask) / sizeof(KeyT);
+			}
+		}
+		return i + countKeysBelowSse2<KeyT>(keys + i, count - i, key);
+	}
+#endif
+}
+
+const char *
+keySearchKernelName(KeySearchKernel kernel) {
+	switch (kernel) {
+		case KEY_SEARCH_SCALAR: return "scalar";
+		case KEY_SEARCH_SSE2: return "sse2";
+		case KEY_SEARCH_AVX2: return "avx2";
+		default: return "unknown";
+	}
+}
+
+bool
+keySearchKernelSupported(KeySearchKernel kernel) {
+	switch (kernel) {
+		case KEY_SEARCH_SCALAR:
+			return true;
+#ifdef STAMINA_KEY_SEARCH_X86
+		case KEY_SEARCH_SSE2:
+			// May run before main, when the CPU model is not filled in yet
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2");
+		case KEY_SEARCH_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+KeySearchKernel
+bestKeySearchKernel() {
+	for (int kernel = KEY_SEARCH_KERNEL_COUNT - 1; kernel > KEY_SEARCH_SCALAR; --kernel) {
+		if (keySearchKernelSupported((KeySearchKernel) kernel)) {
+			return (KeySearchKernel) kernel;
+		}
+	}
+	return KEY_SEARCH_SCALAR;
+}
+
+template <typename KeyT>
+KeySearchFunction<KeyT>
+keySearchFunction(KeySearchKernel kernel) {
+	assert(keySearchKernelSupported(kernel));
+	switch (kernel) {
+#ifdef STAMINA_KEY_SEARCH_X86
+		case KEY_SEARCH_SSE2: return countKeysBelowSse2<KeyT>;
+		case KEY_SEARCH_AVX2: return countKeysBelowAvx2<KeyT>;
+#endif
+		default: return countKeysBelowScalar<KeyT>;
+	}
+}
+
+template KeySearchFunction<uint8_t> keySearchFunction<uint8_t>(KeySearchKernel kernel);
+template KeySearchFunction<uint16_t> keySearchFunction<uint16_t>(KeySearchKernel kernel);
+template KeySearchFunction<uint32_t> keySearchFunction<uint32_t>(KeySearchKernel kernel);
+
+} // namespace vectormap
+} // namespace core
+} // namespace stamina
@@ -0,0 +1,59 @@
+#ifndef STAMINA_CORE_VECTORMAP_KEYSEARCH_H
+#define STAMINA_CORE_VECTORMAP_KEYSEARCH_H
+
+#include <cstdint>
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			/**
+			 * Implementations of the search over the sorted child keys of a trie
+			 * node. The vector kernels compare a whole block of keys at once and
+			 * turn the result into a count with a movemask and a popcount. Every
+			 * kernel exists for 8, 16 and 32-bit keys, and narrower keys fit more
+			 * of them into a block.
+			 * */
+			enum KeySearchKernel {
+				KEY_SEARCH_SCALAR = 0
+				, KEY_SEARCH_SSE2
+				, KEY_SEARCH_AVX2
+				, KEY_SEARCH_KERNEL_COUNT
+			};
+
+			/**
+			 * Signature of every kernel.
+			 *
+			 * @param keys Sorted keys
+			 * @param count Number of keys
+			 * @param key Key to search for
+			 * @return Number of keys less than `key`, which is the position of
+			 * the first key not less than it
+			 * */
+			template <typename KeyT>
+			using KeySearchFunction = uint32_t (*)(const KeyT * keys, uint32_t count, KeyT key);
+
+			const char * keySearchKernelName(KeySearchKernel kernel);
+			// Whether the CPU this runs on can execute a kernel
+			bool keySearchKernelSupported(KeySearchKernel kernel);
+			// The fastest kernel the CPU supports
+			KeySearchKernel bestKeySearchKernel();
+			// Gets a kernel for keys of type KeyT (uint8_t, uint16_t or uint32_t), which must be supported
+			template <typename KeyT>
+			KeySearchFunction<KeyT> keySearchFunction(KeySearchKernel kernel);
+
+			/**
+			 * The kernel picked for this CPU for keys of type KeyT. Used by the
+			 * trie for its mid-sized sorted nodes. The CPU is queried on the
+			 * first call rather than during static initialization, so that a
+			 * trie built by a static constructor of another translation unit
+			 * does not get a kernel that is not set yet.
+			 * */
+			template <typename KeyT>
+			inline KeySearchFunction<KeyT> countKeysBelowFor() {
+				static const KeySearchFunction<KeyT> best = keySearchFunction<KeyT>(bestKeySearchKernel());
+				return best;
+			}
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_KEYSEARCH_H
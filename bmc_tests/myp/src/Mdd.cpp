@@ -0,0 +1,217 @@
+#include "Mdd.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "KeySearch.h"
+
+namespace stamina {
+namespace core {
+namespace vectormap {
+
+namespace {
+	const uint32_t LAST_LEVEL_HEADER_WORDS = 1;
+	const uint32_t INNER_HEADER_WORDS = 2;
+	// Nodes up to this size are searched with the vector kernel
+	const uint32_t VECTOR_SEARCH_MAX_KEYS = 64;
+
+	inline const uint32_t * nodeKeys(const uint32_t * node, bool lastLevel) {
+		return node + (lastLevel ? LAST_LEVEL_HEADER_WORDS : INNER_HEADER_WORDS);
+	}
+	inline const uint32_t * innerChildren(const uint32_t * node) { return node + INNER_HEADER_WORDS + node[0]; }
+	inline const uint32_t * innerBefore(const uint32_t * node) { return node + INNER_HEADER_WORDS + 2 * node[0]; }
+
+	// Position of `key` among the keys of a node, or the child count if it is not there
+	inline uint32_t findKey(const uint32_t * keys, uint32_t count, uint32_t key) {
+		uint32_t position;
+		if (count <= 4) {
+			position = 0;
+			while (position < count && keys[position] < key) ++position;
+		}
+		else if (count <= VECTOR_SEARCH_MAX_KEYS) {
+			position = countKeysBelowFor<uint32_t>()(keys, count, key);
+		}
+		else {
+			position = std::lower_bound(keys, keys + count, key) - keys;
+		}
+		return position < count && keys[position] == key ? position : count;
+	}
+}
+
+Mdd::Mdd()
+	: levels(0)
+	, numberOfStates(0)
+	, nodeCount(0)
+	, root(NULL_NODE)
+	, finished(false)
+{ /* Intentionally left empty */ }
+
+Mdd::Mdd(const Trie & trie, std::vector<uint32_t> * ranks) : Mdd() {
+	if (ranks != nullptr) {
+		ranks->assign(trie.getIndexLimit(), (uint32_t) -1);
+	}
+	trie.forEachState([&](const uint32_t * key, uint16_t length, uint32_t index) {
+		uint32_t const rank = this->add(key, length);
+		if (ranks != nullptr) {
+			(*ranks)[index] = rank;
+		}
+	});
+	this->finish();
+}
+
+std::size_t
+Mdd::NodeHash::operator()(NodeHandle node) const {
+	const uint32_t * words = this->mdd->pool.at(node);
+	uint32_t const size = this->mdd->nodeWords(words, this->lastLevel);
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (uint32_t i = 0; i < size; ++i) {
+		hash = (hash ^ words[i]) * 0x100000001b3ull;
+	}
+	return hash ^ (hash >> 32);
+}
+
+bool
+Mdd::NodeEqual::operator()(NodeHandle first, NodeHandle second) const {
+	const uint32_t * a = this->mdd->pool.at(first);
+	const uint32_t * b = this->mdd->pool.at(second);
+	return a[0] == b[0] && std::equal(a, a + this->mdd->nodeWords(a, this->lastLevel), b);
+}
+
+uint32_t
+Mdd::nodeWords(const uint32_t * node, bool lastLevel) const {
+	return lastLevel ? LAST_LEVEL_HEADER_WORDS + node[0] : INNER_HEADER_WORDS + 3 * node[0];
+}
+
+uint32_t
+Mdd::add(const uint32_t * key, uint16_t length) {
+	assert(!this->finished && length > 0);
+	assert(this->numberOfStates < (uint32_t) -1);
+	uint16_t level = 0;
+	if (this->numberOfStates == 0) {
+		this->levels = length;
+		this->open.resize(length);
+		for (uint16_t l = 0; l < length; ++l) {
+			bool const lastLevel = l + 1 == length;
+			this->uniqueTables.emplace_back(0, NodeHash { this, lastLevel }, NodeEqual { this, lastLevel });
+		}
+	}
+	else {
+		assert(length == this->levels);
+		while (level < length && key[level] == this->open[level].back().first) ++level;
+		assert(level < length && key[level] > this->open[level].back().first);
+		this->closeLevels(level + 1);
+	}
+	for (uint16_t l = level; l < length; ++l) {
+		this->open[l].emplace_back(key[l], NULL_NODE);
+	}
+	return this->numberOfStates++;
+}
+
+void
+Mdd::finish() {
+	assert(!this->finished);
+	if (this->numberOfStates != 0) {
+		this->closeLevels(1);
+		this->root = this->intern(0);
+	}
+	this->finished = true;
+	std::vector<UniqueTable>().swap(this->uniqueTables);
+	std::vector<std::vector<std::pair<uint32_t, NodeHandle>>>().swap(this->open);
+}
+
+// Stores the open nodes of all levels from `level` on, deepest first, and
+// hands each to the open key of the level above it
+void
+Mdd::closeLevels(uint16_t level) {
+	for (uint16_t l = this->levels - 1; l >= level; --l) {
+		this->open[l - 1].back().second = this->intern(l);
+	}
+}
+
+// Turns the open node of a level into a stored node, or finds the stored
+// node with the same children
+NodeHandle
+Mdd::intern(uint16_t level) {
+	auto & entries = this->open[level];
+	bool const lastLevel = level + 1 == this->levels;
+	uint32_t const count = entries.size();
+	uint32_t const words = lastLevel ? LAST_LEVEL_HEADER_WORDS + count : INNER_HEADER_WORDS + 3 * count;
+	NodeHandle handle = this->pool.allocate(words);
+	uint32_t * node = this->pool.at(handle);
+	node[0] = count;
+	if (lastLevel) {
+		for (uint32_t i = 0; i < count; ++i) {
+			node[LAST_LEVEL_HEADER_WORDS + i] = entries[i].first;
+		}
+	}
+	else {
+		bool const childLastLevel = level + 2 == this->levels;
+		uint32_t below = 0;
+		for (uint32_t i = 0; i < count; ++i) {
+			const uint32_t * child = this->pool.at(entries[i].second);
+			node[INNER_HEADER_WORDS + i] = entries[i].first;
+			node[INNER_HEADER_WORDS + count + i] = entries[i].second;
+			node[INNER_HEADER_WORDS + 2 * count + i] = below;
+			below += childLastLevel ? child[0] : child[1];
+		}
+		node[1] = below;
+	}
+	entries.clear();
+
+	auto inserted = this->uniqueTables[level].insert(handle);
+	if (!inserted.second) {
+		this->pool.release(handle, words);
+		return *inserted.first;
+	}
+	++this->nodeCount;
+	return handle;
+}
+
+uint32_t
+Mdd::get(const uint32_t * key, uint16_t length) const {
+	assert(this->finished);
+	if (length != this->levels || this->root == NULL_NODE) {
+		return (uint32_t) -1;
+	}
+	uint32_t rank = 0;
+	NodeHandle handle = this->root;
+	for (uint16_t level = 0; level < length; ++level) {
+		const uint32_t * node = this->pool.at(handle);
+		bool const lastLevel = level + 1 == length;
+		uint32_t const position = findKey(nodeKeys(node, lastLevel), node[0], key[level]);
+		if (position == node[0]) {
+			return (uint32_t) -1;
+		}
+		if (lastLevel) {
+			return rank + position;
+		}
+		rank += innerBefore(node)[position];
+		handle = innerChildren(node)[position];
+	}
+	return (uint32_t) -1;
+}
+
+bool
+Mdd::contains(const uint32_t * key, uint16_t length) const {
+	return this->get(key, length) != (uint32_t) -1;
+}
+
+void
+Mdd::stateOf(uint32_t rank, uint32_t * key) const {
+	assert(this->finished && rank < this->numberOfStates);
+	NodeHandle handle = this->root;
+	for (uint16_t level = 0; level + 1 < this->levels; ++level) {
+		const uint32_t * node = this->pool.at(handle);
+		const uint32_t * before = innerBefore(node);
+		// The last child with fewer states before it than `rank`
+		uint32_t const position = std::upper_bound(before, before + node[0], rank) - before - 1;
+		key[level] = nodeKeys(node, false)[position];
+		rank -= before[position];
+		handle = innerChildren(node)[position];
+	}
+	key[this->levels - 1] = nodeKeys(this->pool.at(handle), true)[rank];
+}
+
+} // namespace vectormap
+} // namespace core
+} // namespace stamina
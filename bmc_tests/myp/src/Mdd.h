@@ -0,0 +1,112 @@
+#ifndef STAMINA_CORE_VECTORMAP_MDD_H
+#define STAMINA_CORE_VECTORMAP_MDD_H
+
+#include <cstdint>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "NodePool.h"
+#include "Trie.h"
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			/**
+			 * Multi-valued decision diagram over the same keys as a Trie. Nodes
+			 * with the same children under the same keys are stored only once,
+			 * through a unique table per level, so a state space that is a
+			 * product of independent parts costs one node per level instead of
+			 * one copy of the lower part under every prefix.
+			 *
+			 * Because nodes are shared, they cannot hold state indices. Every
+			 * inner node instead keeps the number of states below each of its
+			 * children, and the index of a state is its rank, i.e. the number of
+			 * stored keys that are less than it. Ranks only stay the same as long
+			 * as no states are added, so the diagram is built once from keys in
+			 * increasing order (for example from a finished Trie) and is read-only
+			 * afterwards.
+			 *
+			 * Last level nodes are their child count followed by the sorted keys.
+			 * Inner nodes are the child count, the number of states below the
+			 * node, the sorted keys, the child handles, and for each child the
+			 * number of states below the children before it.
+			 * */
+			class Mdd {
+			public:
+				Mdd();
+
+				/**
+				 * Builds the diagram of all states stored in a trie.
+				 *
+				 * @param trie Trie to take the states from
+				 * @param ranks If not null, gets the rank of each trie index, and
+				 * (uint32_t) -1 for indices the trie does not use
+				 * */
+				explicit Mdd(const Trie & trie, std::vector<uint32_t> * ranks = nullptr);
+
+				/**
+				 * Adds a state while building the diagram. Keys must come in
+				 * strictly increasing order and all have the same length.
+				 *
+				 * @param key Decoded key, see Trie::decode()
+				 * @param length Length of the key
+				 * @return The rank of the state
+				 * */
+				uint32_t add(const uint32_t * key, uint16_t length);
+				// Stores the nodes still being built and frees the unique tables.
+				// No states can be added afterwards.
+				void finish();
+
+				// Returns the rank of the state, or (uint32_t) -1 if it is not stored
+				uint32_t get(const uint32_t * key, uint16_t length) const;
+				bool contains(const uint32_t * key, uint16_t length) const;
+				/**
+				 * Finds the state with a given rank.
+				 *
+				 * @param rank Rank of the state, less than getNumberOfStates()
+				 * @param key Gets the `depth()` values of the key
+				 * */
+				void stateOf(uint32_t rank, uint32_t * key) const;
+
+				uint16_t depth() const { return this->levels; }
+				uint32_t getNumberOfStates() const { return this->numberOfStates; }
+				// Number of distinct nodes, after sharing
+				uint64_t getNodeCount() const { return this->nodeCount; }
+				std::size_t bytesInUse() const { return this->pool.bytesInUse(); }
+
+			private:
+				// Hashes and compares nodes by their words, so that a node can be
+				// looked up in the unique table of its level by its handle
+				struct NodeHash {
+					const Mdd * mdd;
+					bool lastLevel;
+					std::size_t operator()(NodeHandle node) const;
+				};
+				struct NodeEqual {
+					const Mdd * mdd;
+					bool lastLevel;
+					bool operator()(NodeHandle first, NodeHandle second) const;
+				};
+				typedef std::unordered_set<NodeHandle, NodeHash, NodeEqual> UniqueTable;
+
+				uint32_t nodeWords(const uint32_t * node, bool lastLevel) const;
+				NodeHandle intern(uint16_t level);
+				void closeLevels(uint16_t level);
+
+				uint16_t levels;
+				uint32_t numberOfStates;
+				uint64_t nodeCount;
+				NodeHandle root;
+				bool finished;
+				// The path of the last added key: for every level, the keys of the
+				// node under construction and the handles of their children. The
+				// child of the last key is still being built.
+				std::vector<std::vector<std::pair<uint32_t, NodeHandle>>> open;
+				std::vector<UniqueTable> uniqueTables;
+				NodePool pool;
+			};
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_MDD_H
@@ -0,0 +1,326 @@
+#ifndef STAMINA_CORE_VECTORMAP_NODEPOOL_H
+#define STAMINA_CORE_VECTORMAP_NODEPOOL_H
+
+#include <cassert>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			/**
+			 * A 32-bit handle to a block of words inside of a NodePool. The upper
+			 * bits select the chunk and the lower `NodePool::CHUNK_BITS` bits are
+			 * the word offset inside of that chunk.
+			 * */
+			typedef uint32_t NodeHandle;
+
+			const NodeHandle NULL_NODE = 0xFFFFFFFF;
+
+			/**
+			 * Arena that trie nodes are carved out of. Memory is requested from the
+			 * system in large chunks which never move, so a raw pointer obtained
+			 * from `at()` stays valid until its block is released. Released blocks
+			 * go onto a free list for their exact size and are handed out again
+			 * before the arena grows.
+			 *
+			 * The chunks can also live in a file instead (see createFile()),
+			 * each mapped into memory on its own, so that the operating system
+			 * pages out the parts of a large pool that are not being used and
+			 * the pool can be mapped again later by openFile(). The file starts
+			 * with a header page that holds the state of the pool and
+			 * `USER_HEADER_WORDS` words for the owner of the pool, followed by
+			 * the chunks. Blocks released before the file is reopened are not
+			 * handed out again.
+			 * */
+			class NodePool {
+			public:
+				static const uint8_t CHUNK_BITS = 20;
+				static const uint32_t CHUNK_WORDS = 1 << CHUNK_BITS;
+				static const uint32_t HEADER_WORDS = 1024;
+				static const uint32_t USER_HEADER_WORDS = HEADER_WORDS - 16;
+				// Chunks a pool can have before its handles run out, about 16 GB
+				static const uint32_t MAX_CHUNKS = NULL_NODE >> CHUNK_BITS;
+
+				NodePool()
+					: nextFree(CHUNK_WORDS)
+					, wordsInUse(0)
+				{ /* Intentionally left empty */ }
+
+				/**
+				 * Allocates a block of words. The contents are uninitialized.
+				 *
+				 * @param words Size of the block, at most `CHUNK_WORDS`
+				 * @return Handle of the new block
+				 * @throws std::length_error If the handles of all `MAX_CHUNKS`
+				 * chunks are used up
+				 * @throws std::runtime_error If the file of the pool cannot be
+				 * grown or mapped, e.g. because the disk is full
+				 * */
+				NodeHandle allocate(uint32_t words) {
+					assert(words > 0 && words <= CHUNK_WORDS);
+					if (words < this->freeLists.size() && !this->freeLists[words].empty()) {
+						NodeHandle handle = this->freeLists[words].back();
+						this->freeLists[words].pop_back();
+						this->wordsInUse += words;
+						return handle;
+					}
+					if (this->nextFree + words > CHUNK_WORDS) {
+						// The tail of the old chunk is simply abandoned. Another
+						// chunk would wrap the handles around into the first
+						// chunk or onto NULL_NODE, so that is an error in every
+						// build.
+						if (this->chunks.size() >= MAX_CHUNKS) {
+							throw std::length_error("NodePool: all 32-bit node handles are in use");
+						}
+						if (this->path.empty()) {
+							this->chunks.emplace_back(new uint32_t[CHUNK_WORDS], ChunkDeleter { 0 });
+						}
+						else {
+							Chunk chunk = this->mapChunk(this->chunks.size(), true);
+							if (!chunk) {
+								throw std::runtime_error("NodePool: cannot grow or map " + this->path);
+							}
+							this->chunks.push_back(std::move(chunk));
+						}
+						this->nextFree = 0;
+					}
+					NodeHandle handle = ((NodeHandle) (this->chunks.size() - 1) << CHUNK_BITS) | this->nextFree;
+					this->nextFree += words;
+					this->wordsInUse += words;
+					return handle;
+				}
+
+				/**
+				 * Returns a block to the pool so that it may be reused.
+				 *
+				 * @param handle Block to release
+				 * @param words The size the block was allocated with
+				 * */
+				void release(NodeHandle handle, uint32_t words) {
+					assert(handle != NULL_NODE);
+					this->wordsInUse -= words;
+					if (this->freeLists.size() <= words) {
+						this->freeLists.resize(words + 1);
+					}
+					this->freeLists[words].push_back(handle);
+				}
+
+				uint32_t * at(NodeHandle handle) {
+					assert(handle != NULL_NODE);
+					return this->chunks[handle >> CHUNK_BITS].get() + (handle & (CHUNK_WORDS - 1));
+				}
+
+				const uint32_t * at(NodeHandle handle) const {
+					assert(handle != NULL_NODE);
+					return this->chunks[handle >> CHUNK_BITS].get() + (handle & (CHUNK_WORDS - 1));
+				}
+
+				/**
+				 * @return Bytes requested from the system, including free space
+				 * */
+				std::size_t bytesReserved() const {
+					return this->chunks.size() * CHUNK_WORDS * sizeof(uint32_t);
+				}
+
+				/**
+				 * @return Bytes held by live blocks
+				 * */
+				std::size_t bytesInUse() const {
+					return this->wordsInUse * sizeof(uint32_t);
+				}
+
+				/**
+				 * Keeps the chunks in a new file from now on. The pool must not
+				 * have allocated anything yet.
+				 *
+				 * @param path File to create, an existing file is overwritten
+				 * @return Whether the file could be created
+				 * */
+				bool createFile(const std::string & path) {
+					assert(this->chunks.empty() && this->path.empty());
+					int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+					if (fd < 0) {
+						return false;
+					}
+					bool const sized = ::posix_fallocate(fd, 0, HEADER_WORDS * sizeof(uint32_t)) == 0;
+					::close(fd);
+					if (!sized) {
+						return false;
+					}
+					this->path = path;
+					this->header = this->mapChunk(HEADER_CHUNK, false);
+					if (!this->header) {
+						this->path.clear();
+						return false;
+					}
+					this->header[0] = FILE_MAGIC;
+					return true;
+				}
+
+				/**
+				 * Maps the chunks of a file written by a pool before, which
+				 * continues where that pool left off. The pool must not have
+				 * allocated anything yet.
+				 *
+				 * @param path File that a pool was created in and synced to
+				 * @return Whether the file could be opened and is a pool file
+				 * that holds all of its chunks. If not, the pool is left unused.
+				 * */
+				bool openFile(const std::string & path) {
+					assert(this->chunks.empty() && this->path.empty());
+					struct stat status;
+					if (::stat(path.c_str(), &status) != 0 || (uint64_t) status.st_size < HEADER_WORDS * sizeof(uint32_t)) {
+						return false;
+					}
+					this->path = path;
+					this->header = this->mapChunk(HEADER_CHUNK, false);
+					if (!this->header || this->header[0] != FILE_MAGIC) {
+						this->closeFile();
+						return false;
+					}
+					uint32_t const chunkCount = this->header[1];
+					// Touching a mapped page past the end of a truncated file
+					// raises SIGBUS, so the file must hold every chunk
+					uint64_t const fileBytes = (uint64_t) HEADER_WORDS * sizeof(uint32_t)
+						+ (uint64_t) chunkCount * CHUNK_WORDS * sizeof(uint32_t);
+					if (chunkCount > MAX_CHUNKS || this->header[2] > CHUNK_WORDS || (uint64_t) status.st_size < fileBytes) {
+						this->closeFile();
+						return false;
+					}
+					for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+						this->chunks.push_back(this->mapChunk(chunk, false));
+						if (!this->chunks.back()) {
+							this->closeFile();
+							return false;
+						}
+					}
+					this->nextFree = chunkCount == 0 ? CHUNK_WORDS : this->header[2];
+					this->wordsInUse = (std::size_t) this->header[3] | (std::size_t) this->header[4] << 32;
+					return true;
+				}
+
+				/**
+				 * Drops all chunks and the file, without syncing it first, so
+				 * that the pool is unused again
+				 * */
+				void closeFile() {
+					this->chunks.clear();
+					this->freeLists.clear();
+					this->header.reset();
+					this->path.clear();
+					this->nextFree = CHUNK_WORDS;
+					this->wordsInUse = 0;
+				}
+
+				/**
+				 * Writes the state of the pool to its file and flushes every
+				 * chunk. Does nothing if the pool is not kept in a file.
+				 * */
+				void sync() {
+					if (this->path.empty()) {
+						return;
+					}
+					this->header[1] = this->chunks.size();
+					this->header[2] = this->nextFree;
+					this->header[3] = (uint32_t) this->wordsInUse;
+					this->header[4] = (uint32_t) ((uint64_t) this->wordsInUse >> 32);
+					for (auto & chunk : this->chunks) {
+						::msync(chunk.get(), CHUNK_WORDS * sizeof(uint32_t), MS_SYNC);
+					}
+					::msync(this->header.get(), HEADER_WORDS * sizeof(uint32_t), MS_SYNC);
+				}
+
+				bool isFileBacked() const { return !this->path.empty(); }
+				// File the chunks are kept in, empty if there is none
+				const std::string & filePath() const { return this->path; }
+
+				/**
+				 * Renames the file of the pool, replacing any file that has the
+				 * new name. The chunks stay mapped.
+				 *
+				 * @param path New name of the file
+				 * @return Whether the file could be renamed
+				 * */
+				bool moveFile(const std::string & path) {
+					assert(!this->path.empty());
+					if (::rename(this->path.c_str(), path.c_str()) != 0) {
+						return false;
+					}
+					this->path = path;
+					return true;
+				}
+
+				/**
+				 * @return The `USER_HEADER_WORDS` words of the file header that
+				 * the owner of the pool may keep its own state in, or null if
+				 * the pool is not kept in a file
+				 * */
+				uint32_t * fileHeader() {
+					return this->header ? this->header.get() + (HEADER_WORDS - USER_HEADER_WORDS) : nullptr;
+				}
+
+			private:
+				// Frees a chunk with delete[], or unmaps it if it is part of a file
+				struct ChunkDeleter {
+					std::size_t mappedBytes;
+					void operator()(uint32_t * chunk) const {
+						if (this->mappedBytes != 0) {
+							::munmap(chunk, this->mappedBytes);
+						}
+						else {
+							delete[] chunk;
+						}
+					}
+				};
+				typedef std::unique_ptr<uint32_t[], ChunkDeleter> Chunk;
+
+				static const uint32_t FILE_MAGIC = 0x4C4F4F50;
+				static const uint32_t HEADER_CHUNK = (uint32_t) -1;
+
+				// Maps the header or a chunk of the file, growing the file first if
+				// `grow` is set. Returns null if that fails. The blocks of a new
+				// chunk are allocated right away: a sparse chunk would only run
+				// out of disk space on its first write, which raises SIGBUS.
+				Chunk mapChunk(uint32_t chunk, bool grow) {
+					std::size_t const bytes = (chunk == HEADER_CHUNK ? HEADER_WORDS : CHUNK_WORDS) * sizeof(uint32_t);
+					off_t const offset = chunk == HEADER_CHUNK ? 0
+						: (off_t) HEADER_WORDS * sizeof(uint32_t) + (off_t) chunk * CHUNK_WORDS * sizeof(uint32_t);
+					int fd = ::open(this->path.c_str(), O_RDWR);
+					if (fd < 0) {
+						return Chunk(nullptr, ChunkDeleter { 0 });
+					}
+					if (grow && ::posix_fallocate(fd, offset, bytes) != 0) {
+						::close(fd);
+						return Chunk(nullptr, ChunkDeleter { 0 });
+					}
+					// The mapping stays valid after the file is closed
+					void * memory = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+					::close(fd);
+					if (memory == MAP_FAILED) {
+						return Chunk(nullptr, ChunkDeleter { 0 });
+					}
+					return Chunk(static_cast<uint32_t *>(memory), ChunkDeleter { bytes });
+				}
+
+				std::vector<Chunk> chunks;
+				std::vector<std::vector<NodeHandle>> freeLists;
+				uint32_t nextFree;
+				std::size_t wordsInUse;
+				// Set if the chunks are kept in a file
+				std::string path;
+				Chunk header { nullptr, ChunkDeleter { 0 } };
+			};
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_NODEPOOL_H
@@ -16,7 +16,24 @@ PYBIND11_MODULE(pypmctrie, m) {
 		.def(pybind11::init<std::vector<std::string>&, std::string, std::string, int>()) // may have to change to include params for constructor
 		.def_readwrite("filename", &Settings::filename)
 		.def_readwrite("propFileName", &Settings::propFileName)
-		.def_readwrite("maxNumToExplore", &Settings::maxNumToExplore);
+		.def_readwrite("maxNumToExplore", &Settings::maxNumToExplore)
+		.def_readwrite("speciesBounds", &Settings::speciesBounds)
+		.def_readwrite("maxDenseSpan", &Settings::maxDenseSpan)
+		.def_readwrite("burstLevels", &Settings::burstLevels)
+		.def_readwrite("burstThreshold", &Settings::burstThreshold)
+		.def_readwrite("batchLookups", &Settings::batchLookups)
+		.def_readwrite("useFixedTrie", &Settings::useFixedTrie)
+		.def_readwrite("buildDiagram", &Settings::buildDiagram)
+		.def_readwrite("freezeTrie", &Settings::freezeTrie)
+		.def_readwrite("trieFile", &Settings::trieFile)
+		.def_readwrite("queueIndices", &Settings::queueIndices)
+		.def_readwrite("pinnedLookups", &Settings::pinnedLookups)
+		.def_readwrite("targetRanges", &Settings::targetRanges)
+		.def_readwrite("statsInterval", &Settings::statsInterval)
+		.def_readwrite("compactInterval", &Settings::compactInterval)
+		.def_readwrite("compactTrie", &Settings::compactTrie)
+		.def_readwrite("printHistograms", &Settings::printHistograms)
+		.def_readwrite("jointHistograms", &Settings::jointHistograms);
 		//.def_readwrite("ordering", Settings::ordering);
 }
 
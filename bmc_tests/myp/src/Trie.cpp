@@ -1,94 +1,2549 @@
 #include "Trie.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
 #include <map>
 #include <iostream>
 #include <vector>
 #include "IndexableBitVector.h"
+#include "KeySearch.h"
 
 namespace stamina {
 namespace core {
 namespace vectormap {
 
+namespace {
+	// Every node starts with its kind and its number of children.
+	//
+	// Sorted nodes (NODE_4, NODE_16, NODE_SORTED):
+	//   [2]                                  capacity, and in the top byte the
+	//                                        log2 of the bytes per key
+	//   [3, 3 + keyWords)                    child keys of 1, 2 or 4 bytes, sorted
+	//   [3 + keyWords, .. + capacity)        child slots
+	//
+	// Indexed node (NODE_48):
+	//   [2]                                  lowest key of the window
+	//   [3, 3 + 64)                          one byte per key of the window, holding
+	//                                        one more than the position of its slot
+	//   [67, 67 + 48)                        child slots, in insertion order
+	//
+	// Dense nodes (NODE_256, NODE_DENSE):
+	//   [2]                                  lowest key
+	//   [3]                                  number of keys (span)
+	//   [4, 4 + span)                        one slot per key, NULL_NODE if empty
+	//
+	// Bitmap node (NODE_BITMAP), only on the last level:
+	//   [2]                                  lowest key
+	//   [3]                                  number of keys (span)
+	//   [4]                                  capacity
+	//   [5, 5 + blocks)                      set bits before each block of 256 keys
+	//   [.., .. + (span + 31) / 32)          one bit per key
+	//   [.., .. + capacity)                  child slots, in key order
+	//
+	// Chain node (NODE_CHAIN), the only kind that covers several levels:
+	//   [1]                                  number of keys in the segment
+	//   [2]                                  slot of the single child
+	//   [3, 3 + length)                      one key per level of the segment
+	//
+	// Bucket node (NODE_BUCKET), which holds the rest of the key of every
+	// state below it:
+	//   [2]                                  capacity
+	//   [3]                                  suffix length
+	//   [4, 4 + capacity * (length + 1))     entries of the suffix keys followed
+	//                                        by the state index, sorted by keys
+	//
+	// A slot holds the handle of the child node, or the state index on the
+	// last species level. The child of a chain is never another chain.
+	const uint32_t SORTED_HEADER_WORDS = 3;
+	const uint32_t CAPACITY_MASK = 0x00FFFFFF;
+	const uint32_t CHAIN_HEADER_WORDS = 3;
+	const uint32_t BUCKET_HEADER_WORDS = 4;
+	const uint32_t BITMAP_HEADER_WORDS = 5;
+	const uint32_t BITMAP_BLOCK_BITS = 256;
+	// Sorted nodes up to this size are searched with the vector kernel
+	const uint32_t VECTOR_SEARCH_MAX_KEYS = 64;
+	// Number of lookups of a batch that walk the trie together
+	const uint32_t BATCH_GROUP_SIZE = 16;
+	const uint32_t DENSE_HEADER_WORDS = 4;
+	const uint32_t WINDOW = 256;
+	const uint32_t INDEXED_CAPACITY = 48;
+	const uint32_t INDEXED_SLOTS_OFFSET = 3 + WINDOW / sizeof(uint32_t);
+	const uint32_t EMPTY_SLOT = NULL_NODE;
+
+	// Words of the pool file header that hold the state of a file backed
+	// trie. The 64-bit node counts take two words each.
+	const uint32_t FILE_MAGIC = 0x54524945;
+	const uint32_t FILE_MAX_INDEX = 1;
+	const uint32_t FILE_INDEX = 2;
+	const uint32_t FILE_DEPTH = 3;
+	const uint32_t FILE_ROOT = 4;
+	const uint32_t FILE_BURST_LEVEL = 5;
+	const uint32_t FILE_BURST_THRESHOLD = 6;
+	const uint32_t FILE_HAS_ORDERING = 7;
+	const uint32_t FILE_FREE_INDICES = 8;
+	const uint32_t FILE_NODE_COUNTS = 9;
+	const uint32_t FILE_LEVEL_COUNT = FILE_NODE_COUNTS + 2 * NODE_KIND_COUNT;
+	const uint32_t FILE_LEVEL_BOUNDS = FILE_LEVEL_COUNT + 1;
+	const uint32_t FILE_KEY_BYTES_COUNT = FILE_LEVEL_BOUNDS + 2 * MAX_KEY_LENGTH;
+	const uint32_t FILE_KEY_BYTES = FILE_KEY_BYTES_COUNT + 1;
+	const uint32_t FILE_ORDERING = FILE_KEY_BYTES + MAX_KEY_LENGTH;
+	static_assert(FILE_ORDERING + MAX_KEY_LENGTH <= NodePool::USER_HEADER_WORDS, "Trie state must fit the file header");
+
+	inline bool isSorted(uint32_t kind) { return kind == NODE_4 || kind == NODE_16 || kind == NODE_SORTED; }
+	inline bool isDense(uint32_t kind) { return kind == NODE_256 || kind == NODE_DENSE; }
+
+	inline uint32_t keyWords(uint32_t capacity, uint32_t keyBytes) { return (capacity * keyBytes + 3) / 4; }
+	inline uint32_t sortedWords(uint32_t capacity, uint32_t keyBytes) {
+		return SORTED_HEADER_WORDS + keyWords(capacity, keyBytes) + capacity;
+	}
+	inline uint32_t denseWords(uint32_t span) { return DENSE_HEADER_WORDS + span; }
+	inline uint32_t indexedWords() { return INDEXED_SLOTS_OFFSET + INDEXED_CAPACITY; }
+	inline uint32_t chainWords(uint32_t length) { return CHAIN_HEADER_WORDS + length; }
+	inline uint32_t bitmapBlocks(uint32_t span) { return (span + BITMAP_BLOCK_BITS - 1) / BITMAP_BLOCK_BITS; }
+	inline uint32_t bitmapBitWords(uint32_t span) { return (span + 31) / 32; }
+	inline uint32_t bitmapWords(uint32_t span, uint32_t capacity) {
+		return BITMAP_HEADER_WORDS + bitmapBlocks(span) + bitmapBitWords(span) + capacity;
+	}
+	inline uint32_t bucketWords(uint32_t capacity, uint32_t length) { return BUCKET_HEADER_WORDS + capacity * (length + 1); }
+	inline uint32_t nodeWords(const uint32_t * node) {
+		if (node[0] == NODE_CHAIN) return chainWords(node[1]);
+		if (node[0] == NODE_BUCKET) return bucketWords(node[2], node[3]);
+		if (node[0] == NODE_BITMAP) return bitmapWords(node[3], node[4]);
+		if (isDense(node[0])) return denseWords(node[3]);
+		if (node[0] == NODE_48) return indexedWords();
+		return sortedWords(node[2] & CAPACITY_MASK, 1u << (node[2] >> 24));
+	}
+
+	inline uint32_t sortedCapacity(const uint32_t * node) { return node[2] & CAPACITY_MASK; }
+	inline uint32_t sortedKeyBytes(const uint32_t * node) { return 1u << (node[2] >> 24); }
+	inline uint32_t * sortedKeys(uint32_t * node) { return node + SORTED_HEADER_WORDS; }
+	inline const uint32_t * sortedKeys(const uint32_t * node) { return node + SORTED_HEADER_WORDS; }
+	inline uint32_t * sortedSlots(uint32_t * node) {
+		return node + SORTED_HEADER_WORDS + keyWords(sortedCapacity(node), sortedKeyBytes(node));
+	}
+	inline const uint32_t * sortedSlots(const uint32_t * node) {
+		return node + SORTED_HEADER_WORDS + keyWords(sortedCapacity(node), sortedKeyBytes(node));
+	}
+
+	inline uint32_t sortedKey(const uint32_t * node, uint32_t position) {
+		switch (sortedKeyBytes(node)) {
+			case 1: return reinterpret_cast<const uint8_t *>(sortedKeys(node))[position];
+			case 2: return reinterpret_cast<const uint16_t *>(sortedKeys(node))[position];
+			default: return sortedKeys(node)[position];
+		}
+	}
+
+	inline void setSortedKey(uint32_t * node, uint32_t position, uint32_t key) {
+		switch (sortedKeyBytes(node)) {
+			case 1: reinterpret_cast<uint8_t *>(sortedKeys(node))[position] = key; break;
+			case 2: reinterpret_cast<uint16_t *>(sortedKeys(node))[position] = key; break;
+			default: sortedKeys(node)[position] = key;
+		}
+	}
+
+	// Smallest of 1, 2 and 4 bytes that holds `key`
+	inline uint32_t keyBytesFor(uint32_t key) { return key <= 0xFF ? 1 : key <= 0xFFFF ? 2 : 4; }
+	inline bool fitsKeyBytes(uint32_t key, uint32_t keyBytes) { return keyBytes == 4 || key >> (8 * keyBytes) == 0; }
+	inline uint32_t * denseSlots(uint32_t * node) { return node + DENSE_HEADER_WORDS; }
+	inline const uint32_t * denseSlots(const uint32_t * node) { return node + DENSE_HEADER_WORDS; }
+	inline uint8_t * indexedIndex(uint32_t * node) { return reinterpret_cast<uint8_t *>(node + 3); }
+	inline const uint8_t * indexedIndex(const uint32_t * node) { return reinterpret_cast<const uint8_t *>(node + 3); }
+	inline uint32_t * indexedSlots(uint32_t * node) { return node + INDEXED_SLOTS_OFFSET; }
+	inline const uint32_t * indexedSlots(const uint32_t * node) { return node + INDEXED_SLOTS_OFFSET; }
+	inline uint32_t * bitmapRanks(uint32_t * node) { return node + BITMAP_HEADER_WORDS; }
+	inline const uint32_t * bitmapRanks(const uint32_t * node) { return node + BITMAP_HEADER_WORDS; }
+	inline uint32_t * bitmapBits(uint32_t * node) { return bitmapRanks(node) + bitmapBlocks(node[3]); }
+	inline const uint32_t * bitmapBits(const uint32_t * node) { return bitmapRanks(node) + bitmapBlocks(node[3]); }
+	inline uint32_t * bitmapSlots(uint32_t * node) { return bitmapBits(node) + bitmapBitWords(node[3]); }
+	inline const uint32_t * bitmapSlots(const uint32_t * node) { return bitmapBits(node) + bitmapBitWords(node[3]); }
+
+	inline bool bitmapHas(const uint32_t * node, uint32_t offset) {
+		return (bitmapBits(node)[offset / 32] >> (offset % 32)) & 1;
+	}
+
+	// Number of set bits before `offset`, which is the position of its slot
+	inline uint32_t bitmapRank(const uint32_t * node, uint32_t offset) {
+		const uint32_t * bits = bitmapBits(node);
+		uint32_t rank = bitmapRanks(node)[offset / BITMAP_BLOCK_BITS];
+		for (uint32_t word = offset / BITMAP_BLOCK_BITS * (BITMAP_BLOCK_BITS / 32); word < offset / 32; ++word) {
+			rank += __builtin_popcount(bits[word]);
+		}
+		return rank + __builtin_popcount(bits[offset / 32] & ((1u << (offset % 32)) - 1));
+	}
+
+	// Smallest node for `capacity` children on a bounded last level. Returns
+	// NODE_SORTED if neither of the range based kinds is worth it yet.
+	inline TrieNodeKind lastLevelKind(uint32_t span, uint32_t capacity, uint32_t keyBytes) {
+		uint32_t const bitmap = bitmapWords(span, capacity);
+		if (denseWords(span) <= bitmap) return NODE_DENSE;
+		return bitmap <= sortedWords(capacity, keyBytes) ? NODE_BITMAP : NODE_SORTED;
+	}
+
+	inline const uint32_t * chainKeys(const uint32_t * node) { return node + CHAIN_HEADER_WORDS; }
+
+	inline uint32_t * bucketEntry(uint32_t * node, uint32_t position) {
+		return node + BUCKET_HEADER_WORDS + position * (node[3] + 1);
+	}
+	inline const uint32_t * bucketEntry(const uint32_t * node, uint32_t position) {
+		return node + BUCKET_HEADER_WORDS + position * (node[3] + 1);
+	}
+
+	// Position of the first bucket entry whose suffix is not less than `suffix`
+	inline uint32_t bucketLowerBound(const uint32_t * node, const uint32_t * suffix) {
+		uint32_t const length = node[3];
+		uint32_t low = 0;
+		uint32_t high = node[1];
+		while (low < high) {
+			uint32_t const middle = (low + high) / 2;
+			const uint32_t * entry = bucketEntry(node, middle);
+			if (std::lexicographical_compare(entry, entry + length, suffix, suffix + length)) {
+				low = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+		return low;
+	}
+
+	// Slot holding the index of the entry for `suffix`, or nullptr if there is none
+	inline const uint32_t * bucketSlot(const uint32_t * node, const uint32_t * suffix) {
+		uint32_t const position = bucketLowerBound(node, suffix);
+		if (position == node[1]) {
+			return nullptr;
+		}
+		const uint32_t * entry = bucketEntry(node, position);
+		return std::equal(entry, entry + node[3], suffix) ? entry + node[3] : nullptr;
+	}
+
+	// Number of leading keys a chain segment has in common with `key`
+	inline uint32_t matchSegment(const uint32_t * node, const uint32_t * key) {
+		const uint32_t * keys = chainKeys(node);
+		return std::mismatch(keys, keys + node[1], key).first - keys;
+	}
+
+	template <typename KeyT>
+	inline uint32_t lowerBound(const KeyT * keys, uint32_t count, KeyT key, KeySearchFunction<KeyT> search) {
+		if (count <= 4) {
+			uint32_t i = 0;
+			while (i < count && keys[i] < key) ++i;
+			return i;
+		}
+		if (count <= VECTOR_SEARCH_MAX_KEYS) {
+			return search(keys, count, key);
+		}
+		return std::lower_bound(keys, keys + count, key) - keys;
+	}
+
+	// Position of the first key in a sorted node that is not less than `key`,
+	// which has to fit into the node's key width
+	inline uint32_t lowerBound(const uint32_t * node, uint32_t key) {
+		const uint32_t * keys = sortedKeys(node);
+		switch (sortedKeyBytes(node)) {
+			case 1: return lowerBound(reinterpret_cast<const uint8_t *>(keys), node[1], (uint8_t) key, countKeysBelowFor<uint8_t>());
+			case 2: return lowerBound(reinterpret_cast<const uint16_t *>(keys), node[1], (uint16_t) key, countKeysBelowFor<uint16_t>());
+			default: return lowerBound(keys, node[1], key, countKeysBelowFor<uint32_t>());
+		}
+	}
+
+	// Slot of the child for `key`, or nullptr if there is none
+	inline const uint32_t * childSlot(const uint32_t * node, uint32_t key) {
+		uint32_t const kind = node[0];
+		if (isDense(kind)) {
+			uint32_t const offset = key - node[2];
+			if (offset >= node[3] || denseSlots(node)[offset] == EMPTY_SLOT) {
+				return nullptr;
+			}
+			return denseSlots(node) + offset;
+		}
+		if (kind == NODE_BITMAP) {
+			uint32_t const offset = key - node[2];
+			if (offset >= node[3] || !bitmapHas(node, offset)) {
+				return nullptr;
+			}
+			return bitmapSlots(node) + bitmapRank(node, offset);
+		}
+		if (kind == NODE_48) {
+			uint32_t const offset = key - node[2];
+			if (offset >= WINDOW || indexedIndex(node)[offset] == 0) {
+				return nullptr;
+			}
+			return indexedSlots(node) + indexedIndex(node)[offset] - 1;
+		}
+		if (!fitsKeyBytes(key, sortedKeyBytes(node))) {
+			return nullptr;
+		}
+		uint32_t position = lowerBound(node, key);
+		if (position == node[1] || sortedKey(node, position) != key) {
+			return nullptr;
+		}
+		return sortedSlots(node) + position;
+	}
+
+	inline uint32_t * childSlot(uint32_t * node, uint32_t key) {
+		return const_cast<uint32_t *>(childSlot(const_cast<const uint32_t *>(node), key));
+	}
+
+	// Takes one step down from `node`, which starts at `level` of `key`.
+	// Returns the slot that was followed, or nullptr if the key is not
+	// there, and moves `level` past the levels the node covers.
+	inline const uint32_t * descend(const uint32_t * node, const uint32_t * key, uint16_t & level) {
+		if (node[0] == NODE_BUCKET) {
+			const uint32_t * slot = bucketSlot(node, key + level);
+			level += node[3];
+			return slot;
+		}
+		if (node[0] == NODE_CHAIN) {
+			if (matchSegment(node, key + level) != node[1]) {
+				return nullptr;
+			}
+			level += node[1];
+			return node + 2;
+		}
+		const uint32_t * slot = childSlot(node, key[level]);
+		++level;
+		return slot;
+	}
+
+	// Calls `f(key, slot)` for every child in increasing key order. On a
+	// node that is not const, `f` may change the slots.
+	template <typename NodeT, typename F>
+	void forEachChild(NodeT * node, F f) {
+		uint32_t const kind = node[0];
+		assert(kind != NODE_CHAIN && kind != NODE_BUCKET);
+		if (isDense(kind)) {
+			for (uint32_t offset = 0; offset < node[3]; ++offset) {
+				if (denseSlots(node)[offset] != EMPTY_SLOT) {
+					f(node[2] + offset, denseSlots(node)[offset]);
+				}
+			}
+			return;
+		}
+		if (kind == NODE_BITMAP) {
+			uint32_t rank = 0;
+			for (uint32_t offset = 0; offset < node[3]; ++offset) {
+				if (bitmapHas(node, offset)) {
+					f(node[2] + offset, bitmapSlots(node)[rank++]);
+				}
+			}
+			return;
+		}
+		if (kind == NODE_48) {
+			for (uint32_t offset = 0; offset < WINDOW; ++offset) {
+				if (indexedIndex(node)[offset] != 0) {
+					f(node[2] + offset, indexedSlots(node)[indexedIndex(node)[offset] - 1]);
+				}
+			}
+			return;
+		}
+		for (uint32_t i = 0; i < node[1]; ++i) {
+			f(sortedKey(node, i), sortedSlots(node)[i]);
+		}
+	}
+
+	// Calls `f(key, slot)` for every child with a key in [low, high], in
+	// increasing key order, without looking at the other children
+	template <typename F>
+	void forEachChildIn(const uint32_t * node, uint32_t low, uint32_t high, F f) {
+		uint32_t const kind = node[0];
+		assert(kind != NODE_CHAIN && kind != NODE_BUCKET);
+		if (isDense(kind) || kind == NODE_BITMAP || kind == NODE_48) {
+			uint32_t const span = kind == NODE_48 ? WINDOW : node[3];
+			if (high < node[2] || (low > node[2] && low - node[2] >= span)) {
+				return;
+			}
+			uint32_t const first = low > node[2] ? low - node[2] : 0;
+			uint32_t const last = std::min(high - node[2], span - 1);
+			if (isDense(kind)) {
+				for (uint32_t offset = first; offset <= last; ++offset) {
+					if (denseSlots(node)[offset] != EMPTY_SLOT) {
+						f(node[2] + offset, denseSlots(node)[offset]);
+					}
+				}
+			}
+			else if (kind == NODE_BITMAP) {
+				uint32_t rank = bitmapRank(node, first);
+				for (uint32_t offset = first; offset <= last; ++offset) {
+					if (bitmapHas(node, offset)) {
+						f(node[2] + offset, bitmapSlots(node)[rank++]);
+					}
+				}
+			}
+			else {
+				for (uint32_t offset = first; offset <= last; ++offset) {
+					if (indexedIndex(node)[offset] != 0) {
+						f(node[2] + offset, indexedSlots(node)[indexedIndex(node)[offset] - 1]);
+					}
+				}
+			}
+			return;
+		}
+		if (!fitsKeyBytes(low, sortedKeyBytes(node))) {
+			// Every key of the node is below `low`
+			return;
+		}
+		for (uint32_t position = lowerBound(node, low); position < node[1]; ++position) {
+			uint32_t const key = sortedKey(node, position);
+			if (key > high) {
+				return;
+			}
+			f(key, sortedSlots(node)[position]);
+		}
+	}
+
+	// Moves `position` in a branching node to the first child at or after
+	// it and gets that child. Positions are indices into the keys of sorted
+	// nodes and offsets from the lowest key otherwise. Returns false if
+	// there is no such child.
+	inline bool nextChild(const uint32_t * node, uint32_t & position, uint32_t & key, uint32_t & slot) {
+		uint32_t const kind = node[0];
+		if (isDense(kind)) {
+			for (; position < node[3]; ++position) {
+				if (denseSlots(node)[position] != EMPTY_SLOT) {
+					key = node[2] + position;
+					slot = denseSlots(node)[position];
+					return true;
+				}
+			}
+			return false;
+		}
+		if (kind == NODE_BITMAP) {
+			// Skips the keys without a child a word of bits at a time
+			while (position < node[3]) {
+				uint32_t const bits = bitmapBits(node)[position / 32] >> (position % 32);
+				if (bits == 0) {
+					position = (position / 32 + 1) * 32;
+					continue;
+				}
+				position += __builtin_ctz(bits);
+				if (position >= node[3]) {
+					return false;
+				}
+				key = node[2] + position;
+				slot = bitmapSlots(node)[bitmapRank(node, position)];
+				return true;
+			}
+			return false;
+		}
+		if (kind == NODE_48) {
+			for (; position < WINDOW; ++position) {
+				if (indexedIndex(node)[position] != 0) {
+					key = node[2] + position;
+					slot = indexedSlots(node)[indexedIndex(node)[position] - 1];
+					return true;
+				}
+			}
+			return false;
+		}
+		if (position < node[1]) {
+			key = sortedKey(node, position);
+			slot = sortedSlots(node)[position];
+			return true;
+		}
+		return false;
+	}
+
+	// Position in a branching node of the first child whose key is not
+	// less than `key`, see nextChild()
+	inline uint32_t childPosition(const uint32_t * node, uint32_t key) {
+		if (isSorted(node[0])) {
+			return fitsKeyBytes(key, sortedKeyBytes(node)) ? lowerBound(node, key) : node[1];
+		}
+		return key > node[2] ? key - node[2] : 0;
+	}
+
+	// Adds a child to a node that has room for it. Sorted nodes shift their
+	// larger keys up, so this is cheapest when keys arrive in increasing order.
+	inline void putChild(uint32_t * node, uint32_t key, uint32_t slot) {
+		uint32_t const kind = node[0];
+		uint32_t const count = node[1];
+		if (isDense(kind)) {
+			denseSlots(node)[key - node[2]] = slot;
+		}
+		else if (kind == NODE_BITMAP) {
+			uint32_t const offset = key - node[2];
+			uint32_t const rank = bitmapRank(node, offset);
+			uint32_t * slots = bitmapSlots(node);
+			std::memmove(slots + rank + 1, slots + rank, (count - rank) * sizeof(uint32_t));
+			slots[rank] = slot;
+			bitmapBits(node)[offset / 32] |= 1u << (offset % 32);
+			for (uint32_t block = offset / BITMAP_BLOCK_BITS + 1; block < bitmapBlocks(node[3]); ++block) {
+				++bitmapRanks(node)[block];
+			}
+		}
+		else if (kind == NODE_48) {
+			indexedSlots(node)[count] = slot;
+			indexedIndex(node)[key - node[2]] = count + 1;
+		}
+		else {
+			uint32_t position = lowerBound(node, key);
+			uint32_t const keyBytes = sortedKeyBytes(node);
+			uint8_t * keys = reinterpret_cast<uint8_t *>(sortedKeys(node));
+			uint32_t * slots = sortedSlots(node);
+			std::memmove(keys + (position + 1) * keyBytes, keys + position * keyBytes, (count - position) * keyBytes);
+			std::memmove(slots + position + 1, slots + position, (count - position) * sizeof(uint32_t));
+			setSortedKey(node, position, key);
+			slots[position] = slot;
+		}
+		node[1] = count + 1;
+	}
+
+	// Removes the child for `key`, which has to be in the node. The node
+	// keeps its kind and size.
+	inline void takeChild(uint32_t * node, uint32_t key) {
+		uint32_t const kind = node[0];
+		uint32_t const count = node[1];
+		if (isDense(kind)) {
+			denseSlots(node)[key - node[2]] = EMPTY_SLOT;
+		}
+		else if (kind == NODE_BITMAP) {
+			uint32_t const offset = key - node[2];
+			uint32_t const rank = bitmapRank(node, offset);
+			uint32_t * slots = bitmapSlots(node);
+			std::memmove(slots + rank, slots + rank + 1, (count - rank - 1) * sizeof(uint32_t));
+			bitmapBits(node)[offset / 32] &= ~(1u << (offset % 32));
+			for (uint32_t block = offset / BITMAP_BLOCK_BITS + 1; block < bitmapBlocks(node[3]); ++block) {
+				--bitmapRanks(node)[block];
+			}
+		}
+		else if (kind == NODE_48) {
+			// The last slot moves into the freed one, so the slots stay packed
+			uint8_t * index = indexedIndex(node);
+			uint32_t const position = index[key - node[2]] - 1;
+			index[key - node[2]] = 0;
+			if (position + 1 != count) {
+				indexedSlots(node)[position] = indexedSlots(node)[count - 1];
+				*std::find(index, index + WINDOW, (uint8_t) count) = position + 1;
+			}
+		}
+		else {
+			uint32_t const position = lowerBound(node, key);
+			uint32_t const keyBytes = sortedKeyBytes(node);
+			uint8_t * keys = reinterpret_cast<uint8_t *>(sortedKeys(node));
+			uint32_t * slots = sortedSlots(node);
+			std::memmove(keys + position * keyBytes, keys + (position + 1) * keyBytes, (count - position - 1) * keyBytes);
+			std::memmove(slots + position, slots + position + 1, (count - position - 1) * sizeof(uint32_t));
+		}
+		node[1] = count - 1;
+	}
+
+	// Whether a node can take one more child with this key without changing
+	inline bool hasRoomFor(const uint32_t * node, uint32_t key) {
+		uint32_t const kind = node[0];
+		if (isDense(kind)) return key - node[2] < node[3];
+		if (kind == NODE_48) return key - node[2] < WINDOW && node[1] < INDEXED_CAPACITY;
+		if (kind == NODE_BITMAP) return key - node[2] < node[3] && node[1] < node[4];
+		return node[1] < sortedCapacity(node) && fitsKeyBytes(key, sortedKeyBytes(node));
+	}
+
+	// A point on one level of a trie, for walking two tries level by level
+	// together although their nodes start and end on different levels.
+	// `slot` holds a node that starts on level `start`, or the state index
+	// once the last level is passed. In a bucket, only the entries [first,
+	// last) have the keys of the levels so far.
+	struct Place {
+		uint32_t slot;
+		uint16_t start;
+		uint32_t first;
+		uint32_t last;
+	};
+
+	// A key on one level of a place and the place it leads to
+	struct Step {
+		uint32_t key;
+		Place child;
+	};
+
+	inline Place placeOf(const NodePool & pool, uint32_t slot, uint16_t level, uint16_t depth) {
+		Place place = { slot, level, 0, 0 };
+		if (level < depth && pool.at(slot)[0] == NODE_BUCKET) {
+			place.last = pool.at(slot)[1];
+		}
+		return place;
+	}
+
+	// Adds the keys of a place on `level` to `steps`, in increasing order
+	inline void stepsOf(const NodePool & pool, const Place & place, uint16_t level, uint16_t depth, std::vector<Step> & steps) {
+		const uint32_t * node = pool.at(place.slot);
+		if (node[0] == NODE_CHAIN) {
+			uint32_t const offset = level - place.start;
+			Place const child = offset + 1 == node[1] ? placeOf(pool, node[2], level + 1, depth) : place;
+			steps.push_back({ chainKeys(node)[offset], child });
+			return;
+		}
+		if (node[0] == NODE_BUCKET) {
+			// The entries with the same key on this level are next to each other
+			uint32_t const column = level - place.start;
+			for (uint32_t first = place.first; first < place.last; ) {
+				uint32_t const key = bucketEntry(node, first)[column];
+				uint32_t last = first + 1;
+				while (last < place.last && bucketEntry(node, last)[column] == key) ++last;
+				Place child = place;
+				child.first = first;
+				child.last = last;
+				if (level + 1 == depth) {
+					child.slot = bucketEntry(node, first)[node[3]];
+				}
+				steps.push_back({ key, child });
+				first = last;
+			}
+			return;
+		}
+		forEachChild(node, [&](uint32_t key, uint32_t slot) {
+			steps.push_back({ key, placeOf(pool, slot, level + 1, depth) });
+		});
+	}
+
+	// Walks two tries with the same depth and ordering together and visits
+	// the states that are in both of them, only in the first one or only in
+	// the second one, as far as they are kept. A subtree that only one of
+	// the tries has is skipped unless its states are kept. A subtree that
+	// both have whole, i.e. the same node of one pool or equal chains or
+	// bucket entries, is not compared level by level, and only walked if
+	// its states are kept. Shared states are counted either way.
+	class Merger {
+	public:
+		Merger(
+			const NodePool & own
+			, const NodePool & other
+			, uint16_t depth
+			, bool keepShared
+			, bool keepOwn
+			, bool keepOther
+			, const Trie::StateVisitor & visit
+		) : pools { &own, &other }
+			, depth(depth)
+			, keep { keepOwn, keepOther }
+			, keepShared(keepShared)
+			, visit(visit)
+			, sharedStates(0)
+		{ /* Intentionally left empty */ }
+
+		// Number of states in both tries found by run(), also if not kept
+		uint32_t getSharedStates() const { return this->sharedStates; }
+
+		void run(NodeHandle ownRoot, NodeHandle otherRoot) {
+			if (ownRoot != NULL_NODE && otherRoot != NULL_NODE) {
+				this->both(placeOf(*this->pools[0], ownRoot, 0, this->depth), placeOf(*this->pools[1], otherRoot, 0, this->depth), 0);
+			}
+			else if (ownRoot != NULL_NODE && this->keep[0]) {
+				this->all(0, placeOf(*this->pools[0], ownRoot, 0, this->depth), 0);
+			}
+			else if (otherRoot != NULL_NODE && this->keep[1]) {
+				this->all(1, placeOf(*this->pools[1], otherRoot, 0, this->depth), 0);
+			}
+		}
+
+	private:
+		void both(const Place & own, const Place & other, uint16_t level) {
+			if (level == this->depth) {
+				++this->sharedStates;
+				if (this->keepShared) {
+					this->visit(this->key, this->depth, own.slot);
+				}
+				return;
+			}
+			const uint32_t * ownNode = this->pools[0]->at(own.slot);
+			const uint32_t * otherNode = this->pools[1]->at(other.slot);
+			if (this->pools[0] == this->pools[1] && own.slot == other.slot && own.start == other.start
+				&& own.first == other.first && own.last == other.last) {
+				this->shared(own, level);
+				return;
+			}
+			if (ownNode[0] == NODE_BUCKET && otherNode[0] == NODE_BUCKET && this->sameEntries(own, other, level)) {
+				this->shared(own, level);
+				return;
+			}
+			if (ownNode[0] == NODE_CHAIN && otherNode[0] == NODE_CHAIN) {
+				this->chains(own, other, level);
+				return;
+			}
+			// The steps of each level are kept between calls, so that walking
+			// does not allocate once the buffers are large enough
+			std::vector<Step> & ownSteps = this->steps[0][level];
+			std::vector<Step> & otherSteps = this->steps[1][level];
+			ownSteps.clear();
+			otherSteps.clear();
+			stepsOf(*this->pools[0], own, level, this->depth, ownSteps);
+			stepsOf(*this->pools[1], other, level, this->depth, otherSteps);
+			std::size_t i = 0;
+			std::size_t j = 0;
+			while (i < ownSteps.size() || j < otherSteps.size()) {
+				if (j == otherSteps.size() || (i < ownSteps.size() && ownSteps[i].key < otherSteps[j].key)) {
+					if (this->keep[0]) {
+						this->key[level] = ownSteps[i].key;
+						this->all(0, ownSteps[i].child, level + 1);
+					}
+					++i;
+				}
+				else if (i == ownSteps.size() || otherSteps[j].key < ownSteps[i].key) {
+					if (this->keep[1]) {
+						this->key[level] = otherSteps[j].key;
+						this->all(1, otherSteps[j].child, level + 1);
+					}
+					++j;
+				}
+				else {
+					this->key[level] = ownSteps[i].key;
+					this->both(ownSteps[i].child, otherSteps[j].child, level + 1);
+					++i;
+					++j;
+				}
+			}
+		}
+
+		// Compares the keys of two chains up to where the first one ends,
+		// and goes on from there with both tries again
+		void chains(const Place & own, const Place & other, uint16_t level) {
+			const uint32_t * ownNode = this->pools[0]->at(own.slot);
+			const uint32_t * otherNode = this->pools[1]->at(other.slot);
+			uint16_t const ownEnd = own.start + ownNode[1];
+			uint16_t const otherEnd = other.start + otherNode[1];
+			const uint32_t * ownKeys = chainKeys(ownNode) + (level - own.start);
+			const uint32_t * otherKeys = chainKeys(otherNode) + (level - other.start);
+			uint16_t const end = std::min(ownEnd, otherEnd);
+			uint16_t at = level;
+			for (; at < end && ownKeys[at - level] == otherKeys[at - level]; ++at) {
+				this->key[at] = ownKeys[at - level];
+			}
+			if (at < end) {
+				// The chains part here, so nothing below is shared
+				int const first = ownKeys[at - level] < otherKeys[at - level] ? 0 : 1;
+				if (this->keep[first]) {
+					this->all(first, first == 0 ? own : other, at);
+				}
+				if (this->keep[1 - first]) {
+					this->all(1 - first, first == 0 ? other : own, at);
+				}
+				return;
+			}
+			Place const ownNext = at == ownEnd ? placeOf(*this->pools[0], ownNode[2], at, this->depth) : own;
+			Place const otherNext = at == otherEnd ? placeOf(*this->pools[1], otherNode[2], at, this->depth) : other;
+			this->both(ownNext, otherNext, at);
+		}
+
+		// Whether two bucket places hold the same key suffixes from `level` on
+		bool sameEntries(const Place & own, const Place & other, uint16_t level) const {
+			if (own.last - own.first != other.last - other.first) {
+				return false;
+			}
+			const uint32_t * ownNode = this->pools[0]->at(own.slot);
+			const uint32_t * otherNode = this->pools[1]->at(other.slot);
+			uint32_t const length = this->depth - level;
+			for (uint32_t entry = 0; entry < own.last - own.first; ++entry) {
+				const uint32_t * ownSuffix = bucketEntry(ownNode, own.first + entry) + (level - own.start);
+				const uint32_t * otherSuffix = bucketEntry(otherNode, other.first + entry) + (level - other.start);
+				if (!std::equal(ownSuffix, ownSuffix + length, otherSuffix)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// A subtree that both tries have whole, with the indices of the first
+		void shared(const Place & own, uint16_t level) {
+			this->sharedStates += this->keepShared ? this->all(0, own, level) : this->countBelow(0, own, level);
+		}
+
+		// Visits every state below a place of one of the tries and returns
+		// their number
+		uint32_t all(int trie, const Place & place, uint16_t level) {
+			if (level == this->depth) {
+				this->visit(this->key, this->depth, place.slot);
+				return 1;
+			}
+			std::vector<Step> & levelSteps = this->steps[trie][level];
+			levelSteps.clear();
+			stepsOf(*this->pools[trie], place, level, this->depth, levelSteps);
+			// The recursion reuses the buffer of the next level only
+			uint32_t count = 0;
+			for (std::size_t i = 0; i < levelSteps.size(); ++i) {
+				this->key[level] = levelSteps[i].key;
+				count += this->all(trie, levelSteps[i].child, level + 1);
+			}
+			return count;
+		}
+
+		// Number of states below a place, without building their keys
+		uint32_t countBelow(int trie, const Place & place, uint16_t level) {
+			if (level == this->depth) {
+				return 1;
+			}
+			const uint32_t * node = this->pools[trie]->at(place.slot);
+			if (node[0] == NODE_BUCKET) {
+				return place.last - place.first;
+			}
+			if (node[0] == NODE_CHAIN) {
+				uint16_t const end = place.start + node[1];
+				return this->countBelow(trie, placeOf(*this->pools[trie], node[2], end, this->depth), end);
+			}
+			std::vector<Step> & levelSteps = this->steps[trie][level];
+			levelSteps.clear();
+			stepsOf(*this->pools[trie], place, level, this->depth, levelSteps);
+			uint32_t count = 0;
+			for (std::size_t i = 0; i < levelSteps.size(); ++i) {
+				count += this->countBelow(trie, levelSteps[i].child, level + 1);
+			}
+			return count;
+		}
+
+		const NodePool * pools[2];
+		uint16_t depth;
+		bool keep[2];
+		bool keepShared;
+		const Trie::StateVisitor & visit;
+		std::vector<Step> steps[2][MAX_KEY_LENGTH];
+		uint32_t key[MAX_KEY_LENGTH];
+		uint32_t sharedStates;
+	};
+
+	inline uint32_t roundUpToPowerOfTwo(uint32_t value) {
+		uint32_t power = 1;
+		while (power < value) power *= 2;
+		return power;
+	}
+}
+
+const char *
+nodeKindName(TrieNodeKind kind) {
+	switch (kind) {
+		case NODE_4: return "NODE_4";
+		case NODE_16: return "NODE_16";
+		case NODE_48: return "NODE_48";
+		case NODE_256: return "NODE_256";
+		case NODE_SORTED: return "NODE_SORTED";
+		case NODE_DENSE: return "NODE_DENSE";
+		case NODE_CHAIN: return "NODE_CHAIN";
+		case NODE_BUCKET: return "NODE_BUCKET";
+		case NODE_BITMAP: return "NODE_BITMAP";
+		default: return "UNKNOWN";
+	}
+}
+
+TrieStats::Level::Level()
+	: nodes()
+	, bytes()
+{ /* Intentionally left empty */ }
+
+TrieStats::TrieStats()
+	: states(0)
+	, bytesInUse(0)
+	, bytesReserved(0)
+	, nodes()
+	, bytes()
+{ /* Intentionally left empty */ }
+
+void
+TrieStats::print(std::ostream & out) const {
+	out << "states\t" << this->states << std::endl;
+	out << "pool\t" << this->bytesInUse << "\t" << this->bytesReserved << std::endl;
+	for (uint32_t kind = 0; kind < NODE_KIND_COUNT; ++kind) {
+		if (this->nodes[kind] != 0) {
+			out << "kind\t" << nodeKindName((TrieNodeKind) kind) << "\t" << this->nodes[kind] << "\t" << this->bytes[kind] << std::endl;
+		}
+	}
+	for (std::size_t level = 0; level < this->levels.size(); ++level) {
+		for (uint32_t kind = 0; kind < NODE_KIND_COUNT; ++kind) {
+			if (this->levels[level].nodes[kind] != 0) {
+				out << "level\t" << level << "\t" << nodeKindName((TrieNodeKind) kind)
+					<< "\t" << this->levels[level].nodes[kind] << "\t" << this->levels[level].bytes[kind] << std::endl;
+			}
+		}
+	}
+	for (std::size_t level = 0; level < this->levels.size(); ++level) {
+		for (auto const & children : this->levels[level].fanOut) {
+			out << "fanout\t" << level << "\t" << children.first << "\t" << children.second << std::endl;
+		}
+	}
+	for (auto const & chains : this->chainLengths) {
+		out << "chain\t" << chains.first << "\t" << chains.second << std::endl;
+	}
+	for (auto const & buckets : this->bucketSizes) {
+		out << "bucket\t" << buckets.first << "\t" << buckets.second << std::endl;
+	}
+}
+
+TrieHistograms::TrieHistograms()
+	: states(0)
+{ /* Intentionally left empty */ }
+
+std::vector<std::pair<uint32_t, uint32_t>>
+TrieHistograms::bounds() const {
+	std::vector<std::pair<uint32_t, uint32_t>> bounds(this->values.size(), { 0, 0 });
+	for (std::size_t species = 0; species < this->values.size(); ++species) {
+		if (!this->values[species].empty()) {
+			bounds[species] = { this->values[species].begin()->first, this->values[species].rbegin()->first };
+		}
+	}
+	return bounds;
+}
+
+std::vector<uint32_t>
+TrieHistograms::orderingByDistinctValues() const {
+	std::vector<uint32_t> ordering(this->values.size());
+	for (uint32_t species = 0; species < ordering.size(); ++species) {
+		ordering[species] = species;
+	}
+	std::stable_sort(ordering.begin(), ordering.end(), [&](uint32_t a, uint32_t b) {
+		return this->values[a].size() < this->values[b].size();
+	});
+	return ordering;
+}
+
+void
+TrieHistograms::print(std::ostream & out) const {
+	for (std::size_t species = 0; species < this->values.size(); ++species) {
+		for (auto const & value : this->values[species]) {
+			out << "value\t" << species << "\t" << value.first << "\t" << value.second << std::endl;
+		}
+	}
+	for (auto const & pair : this->joint) {
+		for (auto const & values : pair.second) {
+			out << "joint\t" << pair.first.first << "\t" << pair.first.second
+				<< "\t" << values.first.first << "\t" << values.first.second << "\t" << values.second << std::endl;
+		}
+	}
+}
+
 Trie::Trie(uint32_t max_index, uint32_t index, uint32_t * ordering) :
-	max_index(max_index)
-	, index(index)
+	index(index)
+	, max_index(max_index)
 	, ordering(ordering)
+	, depth(0)
+	, burstLevel(0)
+	, burstThreshold(0)
+	, root(NULL_NODE)
+	, nodeCounts()
+	, recycleIndices(false)
+	, compactionInterval(0)
+	, insertsSinceCompaction(0)
+	, reverseLookup(false)
+	, pinnedCount(0)
+	, pinExtended(false)
 {
-	// this->max_index = max_index;
-	// this->index = index;
+	/* Intentionally left empty */
 }
 
 Trie::~Trie() {
-	if (this->ordering) {
-		delete this->ordering;
+	this->sync();
+}
+
+void
+Trie::setSpeciesBounds(
+	const std::vector<std::pair<uint32_t, uint32_t>> & speciesBounds
+	, uint32_t maxDenseSpan
+) {
+	assert(this->root == NULL_NODE);
+	this->levelBounds.clear();
+	for (std::size_t level = 0; level < speciesBounds.size(); ++level) {
+		std::size_t species = this->ordering ? this->ordering[level] : level;
+		LevelBounds levelBounds = { 0, 0 };
+		if (species < speciesBounds.size() && speciesBounds[species].first <= speciesBounds[species].second) {
+			auto const & bounds = speciesBounds[species];
+			uint64_t span = (uint64_t) bounds.second - bounds.first + 1;
+			levelBounds.base = bounds.first;
+			levelBounds.span = span <= maxDenseSpan ? (uint32_t) span : 0;
+		}
+		this->levelBounds.push_back(levelBounds);
 	}
 }
 
-// assumes there has already been a contains() check
+void
+Trie::setBurstMode(uint16_t prefixLevels, uint32_t threshold) {
+	assert(this->root == NULL_NODE);
+	this->burstLevel = prefixLevels;
+	this->burstThreshold = std::min(threshold, MAX_BURST_THRESHOLD);
+}
+
+void
+Trie::setKeyWidths(const std::vector<uint16_t> & bitWidths) {
+	assert(this->root == NULL_NODE);
+	this->levelKeyBytes.clear();
+	for (std::size_t level = 0; level < bitWidths.size(); ++level) {
+		std::size_t species = this->ordering ? this->ordering[level] : level;
+		uint16_t const bits = species < bitWidths.size() ? bitWidths[species] : 32;
+		this->levelKeyBytes.push_back(bits <= 8 ? 1 : bits <= 16 ? 2 : 4);
+	}
+}
+
+// Bytes per key of the sorted nodes on a level
 uint32_t
-Trie::get(IndexableBitVector<uint32_t> stateVector, uint16_t pos) {
+Trie::keyBytes(uint16_t level) const {
+	return level < this->levelKeyBytes.size() ? this->levelKeyBytes[level] : 4;
+}
+
+// Creates an empty node. `size` is the capacity of sorted nodes and the
+// span of dense and bitmap nodes, `base` the lowest key of indexed, dense
+// and bitmap nodes, `capacity` the number of slots of bitmap nodes and
+// `keyBytes` the width of the keys of sorted nodes.
+NodeHandle
+Trie::createNode(TrieNodeKind kind, uint32_t size, uint32_t base, uint32_t capacity, uint32_t keyBytes) {
+	assert(keyBytes == 1 || keyBytes == 2 || keyBytes == 4);
+	uint32_t words = isSorted(kind) ? sortedWords(size, keyBytes)
+		: kind == NODE_48 ? indexedWords()
+		: kind == NODE_BITMAP ? bitmapWords(size, capacity)
+		: denseWords(size);
+	NodeHandle handle = this->pool.allocate(words);
+	uint32_t * node = this->pool.at(handle);
+	node[0] = kind;
+	node[1] = 0;
+	if (isSorted(kind)) {
+		assert(size <= CAPACITY_MASK);
+		node[2] = size | (keyBytes == 1 ? 0 : keyBytes == 2 ? 1 : 2) << 24;
+	}
+	else if (kind == NODE_48) {
+		node[2] = base;
+		std::fill(indexedIndex(node), indexedIndex(node) + WINDOW, 0);
+	}
+	else if (kind == NODE_BITMAP) {
+		node[2] = base;
+		node[3] = size;
+		node[4] = capacity;
+		std::fill(bitmapRanks(node), bitmapSlots(node), 0);
+	}
+	else {
+		node[2] = base;
+		node[3] = size;
+		std::fill(denseSlots(node), denseSlots(node) + size, EMPTY_SLOT);
+	}
+	++this->nodeCounts[kind];
+	return handle;
+}
+
+// Creates the first branching node on a level, which is made when a chain
+// splits and so always gets two children
+NodeHandle
+Trie::createNode(uint16_t level) {
+	if (level < this->levelBounds.size() && this->levelBounds[level].span != 0) {
+		LevelBounds const & bounds = this->levelBounds[level];
+		if (level + 1 == this->depth) {
+			TrieNodeKind kind = lastLevelKind(bounds.span, 2, this->keyBytes(level));
+			if (kind != NODE_SORTED) {
+				return this->createNode(kind, bounds.span, bounds.base, 2);
+			}
+		}
+		else if (bounds.span <= DENSE_FROM_START_SPAN) {
+			return this->createNode(NODE_DENSE, bounds.span, bounds.base);
+		}
+	}
+	return this->createNode(NODE_4, 2, 0, 0, this->keyBytes(level));
+}
+
+// Creates a chain node over `count` keys, leading to `slot`
+NodeHandle
+Trie::createSegment(const uint32_t * keys, uint32_t count, uint32_t slot) {
+	assert(count > 0);
+	NodeHandle handle = this->pool.allocate(chainWords(count));
+	uint32_t * node = this->pool.at(handle);
+	node[0] = NODE_CHAIN;
+	node[1] = count;
+	node[2] = slot;
+	std::copy(keys, keys + count, node + CHAIN_HEADER_WORDS);
+	++this->nodeCounts[NODE_CHAIN];
+	return handle;
+}
+
+void
+Trie::releaseNode(NodeHandle node) {
+	const uint32_t * n = this->pool.at(node);
+	--this->nodeCounts[n[0]];
+	this->pool.release(node, nodeWords(n));
+	if (this->reverseLookup) {
+		this->parents.erase(node);
+	}
+}
 
-	if (stateVector.length() == pos + 1) return this->index;
+// Moves the children of a node that has no room for `key` into a node of a
+// kind that does
+NodeHandle
+Trie::regrow(NodeHandle node, uint16_t level, uint32_t key) {
+	const uint32_t * n = this->pool.at(node);
+	uint32_t const needed = n[1] + 1;
+	uint32_t lowest = key;
+	uint32_t highest = key;
+	forEachChild(n, [&](uint32_t childKey, uint32_t) {
+		lowest = std::min(lowest, childKey);
+		highest = std::max(highest, childKey);
+	});
 
-	uint32_t const searchFor = stateVector[pos];
-	return this->children[searchFor]->get(stateVector, pos+1);
+	TrieNodeKind kind;
+	uint32_t size = 0;
+	uint32_t base = 0;
+	uint32_t capacity = 0;
+	// Keys outside of the level's width are still stored, just wider
+	uint32_t const keyBytes = std::max(this->keyBytes(level), keyBytesFor(highest));
+	TrieNodeKind boundedKind = NODE_SORTED;
+	if (level < this->levelBounds.size() && this->levelBounds[level].span != 0) {
+		LevelBounds const & bounds = this->levelBounds[level];
+		if (lowest - bounds.base < bounds.span && highest - bounds.base < bounds.span) {
+			if (level + 1 == this->depth) {
+				// The last level only needs membership, so it may use a bitmap
+				capacity = roundUpToPowerOfTwo(needed);
+				boundedKind = lastLevelKind(bounds.span, capacity, keyBytes);
+			}
+			else if (bounds.span <= DENSE_FROM_START_SPAN || 4 * needed > bounds.span) {
+				// A dense node is no larger than the sorted node would be
+				boundedKind = NODE_DENSE;
+			}
+		}
+	}
+	if (boundedKind != NODE_SORTED) {
+		kind = boundedKind;
+		size = this->levelBounds[level].span;
+		base = this->levelBounds[level].base;
+	}
+	else if (needed <= 4) {
+		kind = NODE_4;
+		size = roundUpToPowerOfTwo(needed);
+	}
+	else if (needed <= 16) {
+		kind = NODE_16;
+		size = roundUpToPowerOfTwo(needed);
+	}
+	else if (highest - lowest < WINDOW) {
+		// Center the window on the keys so it has room on both sides
+		uint32_t const slack = (WINDOW - 1 - (highest - lowest)) / 2;
+		base = lowest > slack ? lowest - slack : 0;
+		if (needed <= INDEXED_CAPACITY) {
+			kind = NODE_48;
+		}
+		else {
+			kind = NODE_256;
+			size = WINDOW;
+		}
+	}
+	else {
+		kind = NODE_SORTED;
+		size = roundUpToPowerOfTwo(needed);
+	}
+
+	NodeHandle moved = this->createNode(kind, size, base, capacity, keyBytes);
+	uint32_t * m = this->pool.at(moved);
+	forEachChild(n, [&](uint32_t childKey, uint32_t slot) {
+		putChild(m, childKey, slot);
+	});
+	this->releaseNode(node);
+	return moved;
+}
+
+// Adds a child which is not in the node yet. The node may have to be moved
+// to grow or to change its kind, so the caller has to store the returned
+// handle.
+NodeHandle
+Trie::addChild(NodeHandle node, uint16_t level, uint32_t key, uint32_t slot) {
+	assert(this->pool.at(node)[0] != NODE_CHAIN);
+	if (!hasRoomFor(this->pool.at(node), key)) {
+		node = this->regrow(node, level, key);
+	}
+	putChild(this->pool.at(node), key, slot);
+	return node;
+}
+
+// Creates an empty bucket for suffixes of `suffixLength` keys
+NodeHandle
+Trie::createBucket(uint32_t suffixLength, uint32_t capacity) {
+	assert(suffixLength > 0 && capacity > 0);
+	NodeHandle handle = this->pool.allocate(bucketWords(capacity, suffixLength));
+	uint32_t * node = this->pool.at(handle);
+	node[0] = NODE_BUCKET;
+	node[1] = 0;
+	node[2] = capacity;
+	node[3] = suffixLength;
+	++this->nodeCounts[NODE_BUCKET];
+	return handle;
+}
+
+// Puts a new entry at `position` of a bucket which is below the burst
+// threshold. The bucket may have to be moved to grow, so the caller has to
+// store the returned handle.
+NodeHandle
+Trie::addEntry(NodeHandle bucket, uint32_t position, const uint32_t * suffix, uint32_t stateIndex) {
+	uint32_t * node = this->pool.at(bucket);
+	uint32_t const count = node[1];
+	uint32_t const stride = node[3] + 1;
+	assert(count < this->burstThreshold);
+	if (count == node[2]) {
+		NodeHandle moved = this->createBucket(node[3], std::min(2 * count, this->burstThreshold));
+		uint32_t * m = this->pool.at(moved);
+		std::copy(bucketEntry(node, 0), bucketEntry(node, count), bucketEntry(m, 0));
+		m[1] = count;
+		this->releaseNode(bucket);
+		bucket = moved;
+		node = m;
+	}
+	uint32_t * entry = bucketEntry(node, position);
+	std::memmove(entry + stride, entry, (count - position) * stride * sizeof(uint32_t));
+	std::copy(suffix, suffix + stride - 1, entry);
+	entry[stride - 1] = stateIndex;
+	node[1] = count + 1;
+	return bucket;
+}
+
+// Replaces a full bucket starting at `level` by a branching node on that
+// level. The entries are grouped by their first key, and each group goes
+// into a bucket of its own one level down.
+NodeHandle
+Trie::burst(NodeHandle bucket, uint16_t level) {
+	const uint32_t * node = this->pool.at(bucket);
+	uint32_t const count = node[1];
+	uint32_t const length = node[3];
+	NodeHandle branch = this->createNode(level);
+	for (uint32_t first = 0; first < count; ) {
+		uint32_t const key = bucketEntry(node, first)[0];
+		uint32_t last = first + 1;
+		while (last < count && bucketEntry(node, last)[0] == key) ++last;
+		uint32_t slot;
+		if (length == 1) {
+			slot = bucketEntry(node, first)[1];
+		}
+		else {
+			slot = this->createBucket(length - 1, roundUpToPowerOfTwo(last - first));
+			uint32_t * child = this->pool.at(slot);
+			// Dropping the first key keeps the entries sorted
+			for (uint32_t i = first; i < last; ++i) {
+				const uint32_t * entry = bucketEntry(node, i);
+				std::copy(entry + 1, entry + length + 1, bucketEntry(child, i - first));
+			}
+			child[1] = last - first;
+		}
+		branch = this->addChild(branch, level, key, slot);
+		first = last;
+	}
+	this->releaseNode(bucket);
+	return branch;
+}
+
+// Builds the single-child path for the levels [level, length) of a key and
+// returns what goes into the slot above it: a chain node, a bucket in burst
+// mode, or the state index itself if there are no levels left
+uint32_t
+Trie::createChain(const uint32_t * key, uint16_t level, uint16_t length, uint32_t stateIndex) {
+	if (level == length) {
+		return stateIndex;
+	}
+	uint32_t slot = stateIndex;
+	uint16_t segmentEnd = length;
+	if (this->burstThreshold != 0 && this->burstLevel < length) {
+		segmentEnd = std::max(level, this->burstLevel);
+		slot = this->createBucket(length - segmentEnd, 1);
+		this->addEntry(slot, 0, key + segmentEnd, stateIndex);
+	}
+	if (segmentEnd == level) {
+		return slot;
+	}
+	return this->createSegment(key + level, segmentEnd - level, slot);
+}
+
+// Splits a chain starting at `level` whose key segment first differs from
+// `key` at position `divergence`. The common part stays a chain, a branching
+// node is put on the level of the difference, and the rest of the old
+// segment and of the key hang below it. Returns the handle that replaces
+// the chain.
+NodeHandle
+Trie::splitChain(
+	NodeHandle chain
+	, uint16_t level
+	, uint32_t divergence
+	, const uint32_t * key
+	, uint16_t length
+	, uint32_t stateIndex
+) {
+	const uint32_t * c = this->pool.at(chain);
+	uint32_t const segmentLength = c[1];
+	uint16_t const branchLevel = level + divergence;
+	assert(divergence < segmentLength && chainKeys(c)[divergence] != key[branchLevel]);
+
+	uint32_t oldRest = divergence + 1 < segmentLength
+		? this->createSegment(chainKeys(c) + divergence + 1, segmentLength - divergence - 1, c[2])
+		: c[2];
+	uint32_t newRest = this->createChain(key, branchLevel + 1, length, stateIndex);
+	NodeHandle branch = this->createNode(branchLevel);
+	branch = this->addChild(branch, branchLevel, chainKeys(c)[divergence], oldRest);
+	branch = this->addChild(branch, branchLevel, key[branchLevel], newRest);
+
+	NodeHandle replacement = divergence > 0
+		? this->createSegment(chainKeys(c), divergence, branch)
+		: branch;
+	this->releaseNode(chain);
+	return replacement;
+}
+
+uint16_t
+Trie::decode(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos, uint32_t * key) const {
+	assert(stateVector.length() - pos <= MAX_KEY_LENGTH);
+	return stateVector.decode(key, pos, this->ordering.get());
+}
+
+// Returns the slot holding the state index, or nullptr if the state is not stored
+const uint32_t *
+Trie::findSlot(const uint32_t * key, uint16_t length) const {
+	if (length != this->depth || this->root == NULL_NODE) {
+		return nullptr;
+	}
+	NodeHandle node = this->root;
+	uint16_t level = 0;
+	while (true) {
+		const uint32_t * slot = descend(this->pool.at(node), key, level);
+		if (slot == nullptr || level == length) {
+			return slot;
+		}
+		node = *slot;
+	}
+}
+
+void
+Trie::getBatch(const uint32_t * keys, uint16_t length, uint32_t count, uint32_t * indices) const {
+	std::fill(indices, indices + count, (uint32_t) -1);
+	if (length != this->depth || this->root == NULL_NODE) {
+		return;
+	}
+	// Where each lookup of the current group is. A lookup leaves the group
+	// by moving the last one into its place.
+	uint32_t position[BATCH_GROUP_SIZE];
+	NodeHandle node[BATCH_GROUP_SIZE];
+	uint16_t level[BATCH_GROUP_SIZE];
+	for (uint32_t first = 0; first < count; first += BATCH_GROUP_SIZE) {
+		uint32_t active = std::min(count - first, BATCH_GROUP_SIZE);
+		for (uint32_t i = 0; i < active; ++i) {
+			position[i] = first + i;
+			node[i] = this->root;
+			level[i] = 0;
+		}
+		// Each round takes every lookup one node further. The node a lookup
+		// needs next is prefetched, and the other lookups of the round give
+		// it time to arrive.
+		while (active > 0) {
+			for (uint32_t i = 0; i < active; ) {
+				const uint32_t * key = keys + (std::size_t) position[i] * length;
+				const uint32_t * slot = descend(this->pool.at(node[i]), key, level[i]);
+				if (slot != nullptr && level[i] < length) {
+					node[i] = *slot;
+					__builtin_prefetch(this->pool.at(node[i]));
+					++i;
+					continue;
+				}
+				if (slot != nullptr) {
+					indices[position[i]] = *slot;
+				}
+				--active;
+				position[i] = position[active];
+				node[i] = node[active];
+				level[i] = level[active];
+			}
+		}
+	}
+}
+
+void
+Trie::findOrInsertBatch(
+	const uint32_t * keys
+	, uint16_t length
+	, uint32_t count
+	, std::pair<uint32_t, bool> * results
+) {
+	std::vector<uint32_t> indices(count);
+	this->getBatch(keys, length, count, indices.data());
+	// States that are not stored yet are inserted in order, so that they get
+	// the same indices as with one findOrInsert() each, also if a state is
+	// in the batch more than once.
+	for (uint32_t i = 0; i < count; ++i) {
+		results[i] = indices[i] != (uint32_t) -1
+			? std::make_pair(indices[i], false)
+			: this->findOrInsert(keys + (std::size_t) i * length, length);
+	}
+}
+
+// Returns (uint32_t) -1 if the state is not in the trie
+uint32_t
+Trie::get(const uint32_t * key, uint16_t length) const {
+	const uint32_t * slot = this->findSlot(key, length);
+	return slot ? *slot : (uint32_t) -1;
 }
 
 bool
-Trie::contains(IndexableBitVector<uint32_t> stateVector, uint16_t pos) {
+Trie::contains(const uint32_t * key, uint16_t length) const {
+	return this->findSlot(key, length) != nullptr;
+}
 
-	if (stateVector.length() == pos) return true;
+std::pair<uint32_t, bool>
+Trie::findOrInsert(const uint32_t * key, uint16_t length) {
+
+	assert(length > 0 && length <= MAX_KEY_LENGTH);
 
-	const uint32_t searchFor = stateVector[pos];
-	if (this->children.find(searchFor) == this->children.end()) {
+	if (this->root == NULL_NODE) {
+		this->depth = length;
+		uint32_t stateIndex = this->nextIndex();
+		this->root = this->createChain(key, 0, length, stateIndex);
+		this->relink(NULL_NODE, this->root, NULL_NODE, 0, stateIndex, length);
+		return std::make_pair(stateIndex, true);
+	}
+	assert(length == this->depth);
+	auto result = this->findOrInsertFrom(&this->root, NULL_NODE, 0, key, length);
+	if (result.second) {
+		// The nodes on the pinned path may have moved
+		this->pinnedCount = 0;
+		this->countInsertion();
+	}
+	return result;
+}
+
+// Walks down from the node whose handle is kept at `nodeRef`, which starts
+// at `level` and is a child of `parent`. Only that node and the nodes below
+// it are changed.
+std::pair<uint32_t, bool>
+Trie::findOrInsertFrom(NodeHandle * nodeRef, NodeHandle parent, uint16_t level, const uint32_t * key, uint16_t length) {
+	// `nodeRef` is where the handle of the current node is kept, so that it
+	// can be updated when the node has to move. Children never move their
+	// parent, so this stays valid while walking down.
+	while (true) {
+		NodeHandle const before = *nodeRef;
+		uint16_t const nodeLevel = level;
+		uint32_t * n = this->pool.at(*nodeRef);
+		uint32_t * slot;
+		if (n[0] == NODE_BUCKET) {
+			uint32_t const position = bucketLowerBound(n, key + level);
+			const uint32_t * entry = bucketEntry(n, position);
+			if (position < n[1] && std::equal(entry, entry + n[3], key + level)) {
+				return std::make_pair(entry[n[3]], false);
+			}
+			if (n[1] == this->burstThreshold) {
+				// Look again in the node the bucket turned into
+				*nodeRef = this->burst(*nodeRef, level);
+				this->relink(before, *nodeRef, parent, nodeLevel, NULL_NODE, nodeLevel);
+				continue;
+			}
+			uint32_t stateIndex = this->nextIndex();
+			*nodeRef = this->addEntry(*nodeRef, position, key + level, stateIndex);
+			this->relink(before, *nodeRef, parent, nodeLevel, stateIndex, length);
+			return std::make_pair(stateIndex, true);
+		}
+		if (n[0] == NODE_CHAIN) {
+			uint32_t const matched = matchSegment(n, key + level);
+			if (matched != n[1]) {
+				uint32_t stateIndex = this->nextIndex();
+				*nodeRef = this->splitChain(*nodeRef, level, matched, key, length, stateIndex);
+				this->relink(before, *nodeRef, parent, nodeLevel, stateIndex, length);
+				return std::make_pair(stateIndex, true);
+			}
+			level += n[1];
+			slot = n + 2;
+		}
+		else {
+			slot = childSlot(n, key[level]);
+			if (slot == nullptr) {
+				uint32_t stateIndex = this->nextIndex();
+				uint32_t newSlot = this->createChain(key, level + 1, length, stateIndex);
+				*nodeRef = this->addChild(*nodeRef, level, key[level], newSlot);
+				this->relink(before, *nodeRef, parent, nodeLevel, newSlot, level + 1);
+				return std::make_pair(stateIndex, true);
+			}
+			++level;
+		}
+		if (level == length) {
+			return std::make_pair(*slot, false);
+		}
+		parent = *nodeRef;
+		nodeRef = slot;
+	}
+}
+
+// Index for a new state: the last one freed by erase() if index recycling
+// is on, and otherwise the next one never given out
+uint32_t
+Trie::nextIndex() {
+	if (this->recycleIndices && !this->freeIndices.empty()) {
+		uint32_t const stateIndex = this->freeIndices.back();
+		this->freeIndices.pop_back();
+		return stateIndex;
+	}
+	return this->max_index++;
+}
+
+bool
+Trie::erase(const uint32_t * key, uint16_t length) {
+	if (length != this->depth || this->root == NULL_NODE) {
 		return false;
 	}
+	// Where the handle of each node on the path is kept and the level that
+	// node starts at, as in the pinned path
+	NodeHandle * refs[MAX_KEY_LENGTH];
+	uint16_t levels[MAX_KEY_LENGTH];
+	uint16_t count = 0;
+	NodeHandle * nodeRef = &this->root;
+	uint16_t level = 0;
+	uint32_t stateIndex;
+	while (true) {
+		refs[count] = nodeRef;
+		levels[count++] = level;
+		uint32_t * slot = const_cast<uint32_t *>(descend(this->pool.at(*nodeRef), key, level));
+		if (slot == nullptr) {
+			return false;
+		}
+		if (level == length) {
+			stateIndex = *slot;
+			break;
+		}
+		nodeRef = slot;
+	}
+
+	// Takes the state out of the deepest node, and every node that this
+	// leaves empty out of the node above it. A chain has only one child,
+	// so it is always left empty.
+	while (count-- > 0) {
+		NodeHandle const node = *refs[count];
+		uint32_t * n = this->pool.at(node);
+		uint16_t const nodeLevel = levels[count];
+		if (n[0] == NODE_BUCKET) {
+			uint32_t const stride = n[3] + 1;
+			uint32_t const position = bucketLowerBound(n, key + nodeLevel);
+			uint32_t * entry = bucketEntry(n, position);
+			std::memmove(entry, entry + stride, (n[1] - position - 1) * stride * sizeof(uint32_t));
+			--n[1];
+		}
+		else if (n[0] != NODE_CHAIN) {
+			takeChild(n, key[nodeLevel]);
+		}
+		if (n[0] != NODE_CHAIN && n[1] != 0) {
+			break;
+		}
+		this->releaseNode(node);
+		*refs[count] = NULL_NODE;
+	}
+
+	if (this->reverseLookup) {
+		this->leafOf[stateIndex] = NULL_NODE;
+	}
+	this->freeIndices.push_back(stateIndex);
+	// The pinned path may go through released nodes
+	this->pinnedCount = 0;
+	return true;
+}
+
+bool
+Trie::erase(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) {
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	return this->erase(key, length);
+}
+
+void
+Trie::setIndexRecycling(bool enabled) {
+	this->recycleIndices = enabled;
+}
+
+std::vector<uint32_t>
+Trie::renumber() {
+	// Marks the free indices, then numbers the others in their old order
+	std::vector<uint32_t> newIndices(this->max_index, 0);
+	for (uint32_t freed : this->freeIndices) {
+		newIndices[freed] = (uint32_t) -1;
+	}
+	uint32_t next = 0;
+	for (uint32_t & index : newIndices) {
+		if (index == 0) {
+			index = next++;
+		}
+	}
+	if (this->root != NULL_NODE) {
+		this->remapIndices(this->root, 0, newIndices);
+	}
+	if (this->reverseLookup) {
+		std::vector<NodeHandle> leafOf(next, NULL_NODE);
+		for (uint32_t index = 0; index < this->leafOf.size(); ++index) {
+			if (this->leafOf[index] != NULL_NODE) {
+				leafOf[newIndices[index]] = this->leafOf[index];
+			}
+		}
+		this->leafOf.swap(leafOf);
+	}
+	this->max_index = next;
+	std::vector<uint32_t>().swap(this->freeIndices);
+	return newIndices;
+}
+
+// `slot` holds a node starting at `level`, or a state index once the whole
+// key is filled in. Replaces every state index below it by its new index.
+void
+Trie::remapIndices(uint32_t & slot, uint16_t level, const std::vector<uint32_t> & newIndices) {
+	if (level == this->depth) {
+		slot = newIndices[slot];
+		return;
+	}
+	uint32_t * node = this->pool.at(slot);
+	if (node[0] == NODE_BUCKET) {
+		for (uint32_t i = 0; i < node[1]; ++i) {
+			uint32_t * entry = bucketEntry(node, i);
+			entry[node[3]] = newIndices[entry[node[3]]];
+		}
+		return;
+	}
+	if (node[0] == NODE_CHAIN) {
+		this->remapIndices(node[2], level + node[1], newIndices);
+		return;
+	}
+	forEachChild(node, [&](uint32_t, uint32_t & childSlot) {
+		this->remapIndices(childSlot, level + 1, newIndices);
+	});
+}
+
+bool
+Trie::compact(uint16_t breadthFirstLevels) {
+	NodePool compacted;
+	std::string const path = this->pool.filePath();
+	if (!path.empty() && !compacted.createFile(path + ".compact")) {
+		return false;
+	}
+	// The old nodes are only read, so if the new pool cannot grow, putting
+	// the old root back leaves the trie as it was
+	NodeHandle const oldRoot = this->root;
+	try {
+		if (this->root != NULL_NODE) {
+			// Where the handle of each node that is still to be copied is kept,
+			// which is a slot of its copied parent, and the level it starts at.
+			// The slot holds the old handle until the node is copied.
+			std::vector<std::pair<NodeHandle *, uint16_t>> queue(1, std::make_pair(&this->root, 0));
+			std::vector<std::pair<NodeHandle *, uint16_t>> subtrees;
+			std::vector<std::pair<NodeHandle *, uint16_t>> children;
+			for (std::size_t next = 0; next < queue.size(); ++next) {
+				children.clear();
+				this->copyNode(compacted, queue[next].first, queue[next].second, children);
+				for (auto const & child : children) {
+					(child.second < breadthFirstLevels ? queue : subtrees).push_back(child);
+				}
+			}
+			std::vector<std::pair<NodeHandle *, uint16_t>> stack;
+			for (auto const & subtree : subtrees) {
+				stack.push_back(subtree);
+				while (!stack.empty()) {
+					auto const node = stack.back();
+					stack.pop_back();
+					children.clear();
+					this->copyNode(compacted, node.first, node.second, children);
+					// The first child goes on top, so it is copied right after its parent
+					stack.insert(stack.end(), children.rbegin(), children.rend());
+				}
+			}
+		}
+	}
+	catch (const std::exception &) {
+		this->root = oldRoot;
+		if (!path.empty()) {
+			compacted.closeFile();
+			std::remove((path + ".compact").c_str());
+		}
+		return false;
+	}
+	// The new file only replaces the old one once all nodes are in it. If
+	// that fails, the old file still matches the old nodes.
+	if (!path.empty() && !compacted.moveFile(path)) {
+		this->root = oldRoot;
+		compacted.closeFile();
+		std::remove((path + ".compact").c_str());
+		return false;
+	}
+	this->pool = std::move(compacted);
+	this->sync();
+	// Only the parents of the nodes are in the reverse lookup, and they all moved
+	this->setReverseLookup(this->reverseLookup);
+	this->pinnedCount = 0;
+	this->insertsSinceCompaction = 0;
+	return true;
+}
+
+// Copies the node whose handle is kept at `nodeRef`, which starts at
+// `level`, into `target` and keeps the handle of the copy there instead.
+// Adds the slots of the copy that hold child nodes to `children`.
+void
+Trie::copyNode(
+	NodePool & target
+	, NodeHandle * nodeRef
+	, uint16_t level
+	, std::vector<std::pair<NodeHandle *, uint16_t>> & children
+) {
+	const uint32_t * n = this->pool.at(*nodeRef);
+	uint32_t const words = nodeWords(n);
+	NodeHandle const copy = target.allocate(words);
+	uint32_t * c = target.at(copy);
+	std::copy(n, n + words, c);
+	*nodeRef = copy;
+	if (c[0] == NODE_BUCKET) {
+		return;
+	}
+	if (c[0] == NODE_CHAIN) {
+		if (level + c[1] < this->depth) {
+			children.emplace_back(c + 2, level + c[1]);
+		}
+		return;
+	}
+	if (level + 1 < this->depth) {
+		forEachChild(c, [&](uint32_t, uint32_t & slot) {
+			children.emplace_back(&slot, level + 1);
+		});
+	}
+}
+
+void
+Trie::setAutoCompaction(uint32_t inserts) {
+	this->compactionInterval = inserts;
+	this->insertsSinceCompaction = 0;
+}
+
+// Counts an inserted state and compacts the trie if it is due. A failed
+// compaction leaves the trie as it was, so it is reported and tried again
+// after the next interval.
+void
+Trie::countInsertion() {
+	if (this->compactionInterval != 0 && ++this->insertsSinceCompaction >= this->compactionInterval) {
+		if (!this->compact()) {
+			std::cerr << "Trie: compaction failed";
+			if (this->pool.isFileBacked()) {
+				std::cerr << ", " << this->pool.filePath() << " is kept as it was";
+			}
+			std::cerr << std::endl;
+			this->insertsSinceCompaction = 0;
+		}
+	}
+}
+
+bool
+Trie::createFile(const std::string & path) {
+	assert(this->root == NULL_NODE);
+	return this->pool.createFile(path);
+}
+
+bool
+Trie::openFile(const std::string & path) {
+	assert(this->root == NULL_NODE);
+	if (!this->pool.openFile(path)) {
+		return false;
+	}
+	const uint32_t * header = this->pool.fileHeader();
+	// A pool file that was never synced by a trie, or one whose sizes
+	// would make the reads below run past the header
+	if (header[0] != FILE_MAGIC
+		|| header[FILE_DEPTH] > MAX_KEY_LENGTH
+		|| header[FILE_LEVEL_COUNT] > MAX_KEY_LENGTH
+		|| header[FILE_KEY_BYTES_COUNT] > MAX_KEY_LENGTH
+	) {
+		this->pool.closeFile();
+		return false;
+	}
+	this->max_index = header[FILE_MAX_INDEX];
+	this->index = header[FILE_INDEX];
+	this->depth = header[FILE_DEPTH];
+	this->root = header[FILE_ROOT];
+	this->burstLevel = header[FILE_BURST_LEVEL];
+	this->burstThreshold = header[FILE_BURST_THRESHOLD];
+	for (uint32_t kind = 0; kind < NODE_KIND_COUNT; ++kind) {
+		this->nodeCounts[kind] = header[FILE_NODE_COUNTS + 2 * kind] | (uint64_t) header[FILE_NODE_COUNTS + 2 * kind + 1] << 32;
+	}
+	this->levelBounds.resize(header[FILE_LEVEL_COUNT]);
+	for (std::size_t level = 0; level < this->levelBounds.size(); ++level) {
+		this->levelBounds[level].base = header[FILE_LEVEL_BOUNDS + 2 * level];
+		this->levelBounds[level].span = header[FILE_LEVEL_BOUNDS + 2 * level + 1];
+	}
+	this->levelKeyBytes.assign(header + FILE_KEY_BYTES, header + FILE_KEY_BYTES + header[FILE_KEY_BYTES_COUNT]);
+	if (header[FILE_HAS_ORDERING]) {
+		this->ordering.reset(new uint32_t[this->depth]);
+		std::copy(header + FILE_ORDERING, header + FILE_ORDERING + this->depth, this->ordering.get());
+	}
+	if (header[FILE_FREE_INDICES] != 0) {
+		// The indices of erased states are not in the file, but they are
+		// the ones no stored state has
+		std::vector<bool> used(this->max_index, false);
+		this->forEachState([&](const uint32_t *, uint16_t, uint32_t index) {
+			used[index] = true;
+		});
+		for (uint32_t index = this->max_index; index-- > 0; ) {
+			if (!used[index]) {
+				this->freeIndices.push_back(index);
+			}
+		}
+		assert(this->freeIndices.size() == header[FILE_FREE_INDICES]);
+	}
+	return true;
+}
+
+void
+Trie::sync() {
+	uint32_t * header = this->pool.fileHeader();
+	if (header == nullptr) {
+		return;
+	}
+	assert(this->levelBounds.size() <= MAX_KEY_LENGTH && this->levelKeyBytes.size() <= MAX_KEY_LENGTH);
+	header[0] = FILE_MAGIC;
+	header[FILE_MAX_INDEX] = this->max_index;
+	header[FILE_INDEX] = this->index;
+	header[FILE_DEPTH] = this->depth;
+	header[FILE_ROOT] = this->root;
+	header[FILE_BURST_LEVEL] = this->burstLevel;
+	header[FILE_BURST_THRESHOLD] = this->burstThreshold;
+	header[FILE_FREE_INDICES] = this->freeIndices.size();
+	for (uint32_t kind = 0; kind < NODE_KIND_COUNT; ++kind) {
+		header[FILE_NODE_COUNTS + 2 * kind] = (uint32_t) this->nodeCounts[kind];
+		header[FILE_NODE_COUNTS + 2 * kind + 1] = (uint32_t) (this->nodeCounts[kind] >> 32);
+	}
+	header[FILE_LEVEL_COUNT] = this->levelBounds.size();
+	for (std::size_t level = 0; level < this->levelBounds.size(); ++level) {
+		header[FILE_LEVEL_BOUNDS + 2 * level] = this->levelBounds[level].base;
+		header[FILE_LEVEL_BOUNDS + 2 * level + 1] = this->levelBounds[level].span;
+	}
+	header[FILE_KEY_BYTES_COUNT] = this->levelKeyBytes.size();
+	std::copy(this->levelKeyBytes.begin(), this->levelKeyBytes.end(), header + FILE_KEY_BYTES);
+	// The ordering has one entry per level, so it is only known to be
+	// complete once the first state fixed the depth
+	header[FILE_HAS_ORDERING] = this->ordering && this->depth != 0;
+	if (header[FILE_HAS_ORDERING]) {
+		std::copy(this->ordering.get(), this->ordering.get() + this->depth, header + FILE_ORDERING);
+	}
+	this->pool.sync();
+}
+
+void
+Trie::setReverseLookup(bool enabled) {
+	this->reverseLookup = enabled;
+	this->leafOf.clear();
+	this->parents.clear();
+	if (enabled && this->root != NULL_NODE) {
+		this->leafOf.assign(this->max_index, NULL_NODE);
+		this->adopt(this->root, NULL_NODE, 0);
+	}
+}
+
+// Records `parent` as the parent of `node`, which starts at `level`. Goes
+// on into the children that have no parent yet, which are new, and only
+// points the others to `node`, in case it moved.
+void
+Trie::adopt(NodeHandle node, NodeHandle parent, uint16_t level) {
+	this->parents[node] = parent;
+	const uint32_t * n = this->pool.at(node);
+	auto adoptChild = [&](uint32_t slot, uint16_t childLevel) {
+		if (childLevel == this->depth) {
+			if (slot >= this->leafOf.size()) {
+				this->leafOf.resize(slot + 1, NULL_NODE);
+			}
+			this->leafOf[slot] = node;
+			return;
+		}
+		auto found = this->parents.find(slot);
+		if (found == this->parents.end()) {
+			this->adopt(slot, node, childLevel);
+		}
+		else {
+			found->second = node;
+		}
+	};
+	if (n[0] == NODE_BUCKET) {
+		for (uint32_t i = 0; i < n[1]; ++i) {
+			adoptChild(bucketEntry(n, i)[n[3]], this->depth);
+		}
+	}
+	else if (n[0] == NODE_CHAIN) {
+		adoptChild(n[2], level + n[1]);
+	}
 	else {
-		return this->children[searchFor]->contains(stateVector, pos+1);
+		forEachChild(n, [&](uint32_t, uint32_t slot) {
+			adoptChild(slot, level + 1);
+		});
+	}
+}
+
+// Updates the reverse lookup after an insertion changed the node at
+// `level` from `before` to `after`. If it stayed in place, `child` is the
+// only thing that is new in it: a child starting at `childLevel`, or a
+// state index if that is the last level.
+void
+Trie::relink(NodeHandle before, NodeHandle after, NodeHandle parent, uint16_t level, uint32_t child, uint16_t childLevel) {
+	if (!this->reverseLookup) {
+		return;
+	}
+	if (after != before) {
+		this->adopt(after, parent, level);
+	}
+	else if (childLevel == this->depth) {
+		if (child >= this->leafOf.size()) {
+			this->leafOf.resize(child + 1, NULL_NODE);
+		}
+		this->leafOf[child] = after;
+	}
+	else {
+		this->adopt(child, after, childLevel);
+	}
+}
+
+uint16_t
+Trie::stateOf(uint32_t index, uint32_t * key) const {
+	assert(this->reverseLookup && index < this->leafOf.size() && this->leafOf[index] != NULL_NODE);
+	// The nodes from the one holding the index up to the root
+	NodeHandle path[MAX_KEY_LENGTH + 1];
+	uint16_t count = 0;
+	for (NodeHandle node = this->leafOf[index]; node != NULL_NODE; node = this->parents.at(node)) {
+		assert(count <= MAX_KEY_LENGTH);
+		path[count++] = node;
+	}
+	uint16_t level = 0;
+	while (count-- > 0) {
+		const uint32_t * n = this->pool.at(path[count]);
+		uint32_t const next = count > 0 ? path[count - 1] : index;
+		if (n[0] == NODE_BUCKET) {
+			uint32_t i = 0;
+			while (bucketEntry(n, i)[n[3]] != index) ++i;
+			std::copy(bucketEntry(n, i), bucketEntry(n, i) + n[3], key + level);
+			level += n[3];
+		}
+		else if (n[0] == NODE_CHAIN) {
+			std::copy(chainKeys(n), chainKeys(n) + n[1], key + level);
+			level += n[1];
+		}
+		else {
+			forEachChild(n, [&](uint32_t childKey, uint32_t slot) {
+				if (slot == next) {
+					key[level] = childKey;
+				}
+			});
+			++level;
+		}
+	}
+	assert(level == this->depth);
+	return level;
+}
+
+void
+Trie::stateOf(uint32_t index, CompressedState & state) const {
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->stateOf(index, key);
+	IndexableBitVector<uint32_t>::encode(key, length, state, this->ordering.get());
+}
+
+FrozenTrie
+Trie::freeze() const {
+	return FrozenTrie(*this);
+}
+
+void
+Trie::forEachState(const StateVisitor & visit) const {
+	if (this->root == NULL_NODE) {
+		return;
 	}
+	uint32_t key[MAX_KEY_LENGTH];
+	this->visitStates(this->root, 0, key, visit);
+}
+
+// `slot` is a node starting at `level`, or the state index once the whole
+// key is filled in
+void
+Trie::visitStates(uint32_t slot, uint16_t level, uint32_t * key, const StateVisitor & visit) const {
+	if (level == this->depth) {
+		visit(key, this->depth, slot);
+		return;
+	}
+	const uint32_t * node = this->pool.at(slot);
+	if (node[0] == NODE_BUCKET) {
+		for (uint32_t i = 0; i < node[1]; ++i) {
+			const uint32_t * entry = bucketEntry(node, i);
+			std::copy(entry, entry + node[3], key + level);
+			visit(key, this->depth, entry[node[3]]);
+		}
+		return;
+	}
+	if (node[0] == NODE_CHAIN) {
+		std::copy(chainKeys(node), chainKeys(node) + node[1], key + level);
+		this->visitStates(node[2], level + node[1], key, visit);
+		return;
+	}
+	forEachChild(node, [&](uint32_t childKey, uint32_t childSlot) {
+		key[level] = childKey;
+		this->visitStates(childSlot, level + 1, key, visit);
+	});
+}
+
+void
+Trie::forEachStateInRange(const std::vector<std::pair<uint32_t, uint32_t>> & ranges, const StateVisitor & visit) const {
+	if (this->root == NULL_NODE) {
+		return;
+	}
+	// The ranges in the order of the levels. Species without a range take
+	// any value.
+	uint32_t low[MAX_KEY_LENGTH];
+	uint32_t high[MAX_KEY_LENGTH];
+	for (uint16_t level = 0; level < this->depth; ++level) {
+		std::size_t species = this->ordering ? this->ordering[level] : level;
+		low[level] = species < ranges.size() ? ranges[species].first : 0;
+		high[level] = species < ranges.size() ? ranges[species].second : (uint32_t) -1;
+		if (low[level] > high[level]) {
+			return;
+		}
+	}
+	uint32_t key[MAX_KEY_LENGTH];
+	this->visitRange(this->root, 0, key, low, high, visit);
 }
 
-// assumes we already did a contains() check; will overwrite otherwise
-// ^^ This is a problem and is causing some unit tests to fail.
 uint32_t
-Trie::insert(IndexableBitVector<uint32_t> stateVector, uint16_t pos) {
+Trie::countStatesInRange(const std::vector<std::pair<uint32_t, uint32_t>> & ranges) const {
+	uint32_t count = 0;
+	this->forEachStateInRange(ranges, [&](const uint32_t *, uint16_t, uint32_t) {
+		++count;
+	});
+	return count;
+}
 
-	assert(pos < stateVector.length());
+void
+Trie::unite(const Trie & other, Trie & result) const {
+	this->merge(other, true, true, true, [&](const uint32_t * key, uint16_t length, uint32_t) {
+		result.findOrInsert(key, length);
+	});
+}
 
-	uint32_t searchFor = stateVector[pos];
+void
+Trie::intersect(const Trie & other, Trie & result) const {
+	this->merge(other, true, false, false, [&](const uint32_t * key, uint16_t length, uint32_t) {
+		result.findOrInsert(key, length);
+	});
+}
 
-	auto newTrie = std::make_shared<Trie>(Trie(this->max_index, this->max_index)); // TODO: Set the properties here
-	this->children[searchFor] = newTrie;
+void
+Trie::subtract(const Trie & other, Trie & result) const {
+	this->merge(other, false, true, false, [&](const uint32_t * key, uint16_t length, uint32_t) {
+		result.findOrInsert(key, length);
+	});
+}
+
+void
+Trie::merge(
+	const Trie & other
+	, bool keepShared
+	, bool keepOwn
+	, bool keepOther
+	, const StateVisitor & visit
+) const {
+	assert(this->root == NULL_NODE || other.root == NULL_NODE || this->depth == other.depth);
+	uint16_t const depth = this->root != NULL_NODE ? this->depth : other.depth;
+	// Keys of the two tries are only comparable with the same ordering
+	for (uint16_t level = 0; level < depth; ++level) {
+		assert((this->ordering ? this->ordering[level] : level) == (other.ordering ? other.ordering[level] : level));
+	}
+	Merger merger(this->pool, other.pool, depth, keepShared, keepOwn, keepOther, visit);
+	merger.run(this->root, other.root);
+}
+
+uint32_t
+Trie::countIntersection(const Trie & other) const {
+	assert(this->root == NULL_NODE || other.root == NULL_NODE || this->depth == other.depth);
+	uint16_t const depth = this->root != NULL_NODE ? this->depth : other.depth;
+	// Nothing is visited, so whole shared subtrees are only counted
+	StateVisitor const none;
+	Merger merger(this->pool, other.pool, depth, false, false, false, none);
+	merger.run(this->root, other.root);
+	return merger.getSharedStates();
+}
+
+uint32_t
+Trie::countUnion(const Trie & other) const {
+	return this->getNumberOfStates() + other.getNumberOfStates() - this->countIntersection(other);
+}
+
+uint32_t
+Trie::countDifference(const Trie & other) const {
+	return this->getNumberOfStates() - this->countIntersection(other);
+}
+
+// Like visitStates(), but only goes into the children whose keys are in
+// [low, high] of their level
+void
+Trie::visitRange(
+	uint32_t slot
+	, uint16_t level
+	, uint32_t * key
+	, const uint32_t * low
+	, const uint32_t * high
+	, const StateVisitor & visit
+) const {
+	if (level == this->depth) {
+		visit(key, this->depth, slot);
+		return;
+	}
+	auto const inRange = [&](const uint32_t * keys, uint16_t first, uint16_t count) {
+		for (uint16_t i = 0; i < count; ++i) {
+			if (keys[i] < low[first + i] || keys[i] > high[first + i]) {
+				return false;
+			}
+		}
+		return true;
+	};
+	const uint32_t * node = this->pool.at(slot);
+	if (node[0] == NODE_BUCKET) {
+		// The entries are sorted, so the ones with a first key in range
+		// are next to each other
+		uint32_t first[MAX_KEY_LENGTH] = { low[level] };
+		for (uint32_t i = bucketLowerBound(node, first); i < node[1]; ++i) {
+			const uint32_t * entry = bucketEntry(node, i);
+			if (entry[0] > high[level]) {
+				break;
+			}
+			if (inRange(entry + 1, level + 1, node[3] - 1)) {
+				std::copy(entry, entry + node[3], key + level);
+				visit(key, this->depth, entry[node[3]]);
+			}
+		}
+		return;
+	}
+	if (node[0] == NODE_CHAIN) {
+		if (inRange(chainKeys(node), level, node[1])) {
+			std::copy(chainKeys(node), chainKeys(node) + node[1], key + level);
+			this->visitRange(node[2], level + node[1], key, low, high, visit);
+		}
+		return;
+	}
+	forEachChildIn(node, low[level], high[level], [&](uint32_t childKey, uint32_t childSlot) {
+		key[level] = childKey;
+		this->visitRange(childSlot, level + 1, key, low, high, visit);
+	});
+}
+
+Trie::Cursor::Cursor(const Trie & trie)
+	: trie(trie)
+	, frameCount(0)
+	, stateIndex((uint32_t) -1)
+{
+	if (trie.root != NULL_NODE) {
+		this->push(trie.root, 0);
+		this->settle();
+	}
+}
+
+void
+Trie::Cursor::push(NodeHandle node, uint16_t level) {
+	assert(this->frameCount < MAX_KEY_LENGTH);
+	Frame & frame = this->frames[this->frameCount++];
+	frame.node = node;
+	frame.level = level;
+	frame.position = 0;
+}
+
+// Goes down from the current child of the deepest frame to the first
+// state below it. Every node has a child, so there always is one.
+void
+Trie::Cursor::settle() {
+	while (true) {
+		Frame & frame = this->frames[this->frameCount - 1];
+		const uint32_t * n = this->trie.pool.at(frame.node);
+		uint32_t slot;
+		uint16_t childLevel;
+		if (n[0] == NODE_BUCKET) {
+			const uint32_t * entry = bucketEntry(n, frame.position);
+			std::copy(entry, entry + n[3], this->keys + frame.level);
+			this->stateIndex = entry[n[3]];
+			return;
+		}
+		if (n[0] == NODE_CHAIN) {
+			std::copy(chainKeys(n), chainKeys(n) + n[1], this->keys + frame.level);
+			slot = n[2];
+			childLevel = frame.level + n[1];
+		}
+		else {
+			bool const found = nextChild(n, frame.position, this->keys[frame.level], slot);
+			assert(found);
+			(void) found;
+			childLevel = frame.level + 1;
+		}
+		if (childLevel == this->trie.depth) {
+			this->stateIndex = slot;
+			return;
+		}
+		this->push(slot, childLevel);
+	}
+}
+
+void
+Trie::Cursor::next() {
+	while (this->frameCount > 0) {
+		Frame & frame = this->frames[this->frameCount - 1];
+		const uint32_t * n = this->trie.pool.at(frame.node);
+		bool more = false;
+		if (n[0] == NODE_BUCKET) {
+			more = ++frame.position < n[1];
+		}
+		else if (n[0] != NODE_CHAIN) {
+			// A chain has only one child, so it is done once that is
+			uint32_t key;
+			uint32_t slot;
+			more = nextChild(n, ++frame.position, key, slot);
+		}
+		if (more) {
+			this->settle();
+			return;
+		}
+		--this->frameCount;
+	}
+}
+
+bool
+Trie::Cursor::seek(const uint32_t * prefix, uint16_t length) {
+	assert(length <= this->trie.depth);
+	this->frameCount = 0;
+	if (this->trie.root == NULL_NODE) {
+		return false;
+	}
+	this->push(this->trie.root, 0);
+	while (true) {
+		Frame & frame = this->frames[this->frameCount - 1];
+		if (frame.level >= length) {
+			// Every state below has the prefix
+			this->settle();
+			return true;
+		}
+		const uint32_t * n = this->trie.pool.at(frame.node);
+		// Only the levels of the prefix are compared
+		uint32_t const compared = std::min<uint32_t>(length - frame.level, n[0] == NODE_CHAIN ? n[1] : n[0] == NODE_BUCKET ? n[3] : 1);
+		const uint32_t * part = prefix + frame.level;
+		if (n[0] == NODE_BUCKET) {
+			uint32_t low = 0;
+			uint32_t high = n[1];
+			while (low < high) {
+				uint32_t const middle = (low + high) / 2;
+				const uint32_t * entry = bucketEntry(n, middle);
+				if (std::lexicographical_compare(entry, entry + compared, part, part + compared)) {
+					low = middle + 1;
+				}
+				else {
+					high = middle;
+				}
+			}
+			if (low < n[1]) {
+				frame.position = low;
+				this->settle();
+				return true;
+			}
+		}
+		else if (n[0] == NODE_CHAIN) {
+			const uint32_t * keys = chainKeys(n);
+			auto const differs = std::mismatch(keys, keys + compared, part);
+			if (differs.first == keys + compared) {
+				std::copy(keys, keys + n[1], this->keys + frame.level);
+				if (frame.level + n[1] == this->trie.depth) {
+					this->stateIndex = n[2];
+					return true;
+				}
+				this->push(n[2], frame.level + n[1]);
+				continue;
+			}
+			if (*differs.first > *differs.second) {
+				this->settle();
+				return true;
+			}
+		}
+		else {
+			uint32_t slot;
+			frame.position = childPosition(n, part[0]);
+			if (nextChild(n, frame.position, this->keys[frame.level], slot)) {
+				if (this->keys[frame.level] > part[0]) {
+					this->settle();
+					return true;
+				}
+				if (frame.level + 1 == this->trie.depth) {
+					this->stateIndex = slot;
+					return true;
+				}
+				this->push(slot, frame.level + 1);
+				continue;
+			}
+		}
+		// Every state below this node is less than the prefix, so the
+		// answer is the first state after them
+		--this->frameCount;
+		this->next();
+		return this->valid();
+	}
+}
+
+void
+Trie::Cursor::state(CompressedState & state) const {
+	IndexableBitVector<uint32_t>::encode(this->keys, this->trie.depth, state, this->trie.ordering.get());
+}
+
+void
+Trie::pin(const uint32_t * key, uint16_t length) {
+	this->pinnedKey.assign(key, key + length);
+	this->pinnedCount = 0;
+	if (this->root == NULL_NODE || length != this->depth) {
+		return;
+	}
+	this->pinnedRefs[0] = &this->root;
+	this->pinnedLevels[0] = 0;
+	this->pinnedCount = 1;
+	this->extendPin();
+}
+
+void
+Trie::pin(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) {
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	this->pin(key, length);
+}
 
-	if (stateVector.length() - 1 == pos) {
-		return ++this->max_index;
+// Follows the pinned key down from the last node recorded for it, for as
+// long as the key is stored
+void
+Trie::extendPin() {
+	const uint32_t * key = this->pinnedKey.data();
+	uint16_t const length = this->pinnedKey.size();
+	NodeHandle * nodeRef = this->pinnedRefs[--this->pinnedCount];
+	uint16_t level = this->pinnedLevels[this->pinnedCount];
+	while (true) {
+		this->pinnedRefs[this->pinnedCount] = nodeRef;
+		this->pinnedLevels[this->pinnedCount++] = level;
+		uint32_t * n = this->pool.at(*nodeRef);
+		uint32_t * slot;
+		if (n[0] == NODE_BUCKET) {
+			break;
+		}
+		if (n[0] == NODE_CHAIN) {
+			if (matchSegment(n, key + level) != n[1]) {
+				break;
+			}
+			level += n[1];
+			slot = n + 2;
+		}
+		else {
+			slot = childSlot(n, key[level]);
+			if (slot == nullptr) {
+				break;
+			}
+			++level;
+		}
+		if (level == length) {
+			break;
+		}
+		nodeRef = slot;
 	}
+	this->pinExtended = true;
+}
 
-	// std::cout << "-- before rec: this->max_index=" << this->max_index << std::endl;
+std::pair<uint32_t, bool>
+Trie::findOrInsertPinned(const uint32_t * key, uint16_t length) {
+	if (this->pinnedCount == 0 || length != this->pinnedKey.size()) {
+		return this->findOrInsert(key, length);
+	}
+	uint16_t const differs = std::mismatch(this->pinnedKey.begin(), this->pinnedKey.end(), key).first - this->pinnedKey.begin();
+	if (!this->pinExtended && this->pinnedLevels[this->pinnedCount - 1] < differs) {
+		this->extendPin();
+	}
+	// The deepest node on the pinned path that the key also goes through
+	uint16_t i = this->pinnedCount - 1;
+	while (this->pinnedLevels[i] > differs) --i;
+	NodeHandle const parent = i > 0 ? *this->pinnedRefs[i - 1] : NULL_NODE;
+	auto result = this->findOrInsertFrom(this->pinnedRefs[i], parent, this->pinnedLevels[i], key, length);
+	if (result.second) {
+		// The nodes below the one the walk started at may have moved, but
+		// that one is still kept at the same place
+		this->pinnedCount = i + 1;
+		this->pinExtended = false;
+		this->countInsertion();
+	}
+	return result;
+}
 
-	this->max_index = this->children[searchFor]->insert(stateVector, pos+1);
+std::pair<uint32_t, bool>
+Trie::findOrInsertPinned(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) {
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	return this->findOrInsertPinned(key, length);
+}
 
-	// std::cout << "Inserted node " << this->children[searchFor]->index << " with children " << std::endl;
-	// this->printChildren();
+uint32_t
+Trie::get(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) const {
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	return this->get(key, length);
+}
 
-	// std::cout << "-- after rec: this->max_index=" << this->max_index << std::endl;
+bool
+Trie::contains(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) const {
 
-	return this->max_index;
+	if (stateVector.length() == pos) return true;
 
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	return this->contains(key, length);
+}
+
+std::pair<uint32_t, bool>
+Trie::findOrInsert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) {
+
+	assert(pos < stateVector.length());
+
+	uint32_t key[MAX_KEY_LENGTH];
+	uint16_t length = this->decode(stateVector, pos, key);
+	return this->findOrInsert(key, length);
+}
+
+// Returns one more than the index of the state. A state which is already
+// stored keeps its index, nothing is overwritten.
+uint32_t
+Trie::insert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos) {
+	return this->findOrInsert(stateVector, pos).first + 1;
 }
 
 void
 Trie::printChildren() {
-	std::map<uint32_t, std::shared_ptr<Trie>>::iterator iter = this->children.begin();
-	while (iter != children.end()) {
-		std::cout << "---- Value: " << iter->first << ", Points to Trie: " << iter->second->index << std::endl;
-		iter++;
+	if (this->root == NULL_NODE) return;
+	const uint32_t * root = this->pool.at(this->root);
+	if (root[0] == NODE_CHAIN) {
+		std::cout << "---- Segment:";
+		for (uint32_t i = 0; i < root[1]; ++i) {
+			std::cout << " " << chainKeys(root)[i];
+		}
+		std::cout << ", Points to Trie: " << root[2] << std::endl;
+		return;
+	}
+	if (root[0] == NODE_BUCKET) {
+		std::cout << "---- Bucket of " << root[1] << " states" << std::endl;
+		return;
 	}
+	forEachChild(root, [](uint32_t key, uint32_t slot) {
+		std::cout << "---- Value: " << key << ", Points to Trie: " << slot << std::endl;
+	});
 }
 
 uint32_t
-Trie::getNumberOfStates() {
-	return this->max_index;
+Trie::getNumberOfStates() const {
+	return this->max_index - this->freeIndices.size();
+}
+
+uint64_t
+Trie::getNodeCount(TrieNodeKind kind) const {
+	return this->nodeCounts[kind];
+}
+
+void
+Trie::printNodeCounts(std::ostream & out) const {
+	for (uint32_t kind = 0; kind < NODE_KIND_COUNT; ++kind) {
+		out << nodeKindName((TrieNodeKind) kind) << "\t" << this->nodeCounts[kind] << std::endl;
+	}
+}
+
+TrieStats
+Trie::stats() const {
+	TrieStats stats;
+	stats.states = this->getNumberOfStates();
+	stats.bytesInUse = this->pool.bytesInUse();
+	stats.bytesReserved = this->pool.bytesReserved();
+	stats.levels.resize(this->depth);
+	if (this->root != NULL_NODE) {
+		this->collectStats(this->root, 0, stats);
+	}
+	return stats;
+}
+
+void
+Trie::collectStats(NodeHandle node, uint16_t level, TrieStats & stats) const {
+	const uint32_t * n = this->pool.at(node);
+	uint32_t const kind = n[0];
+	uint64_t const bytes = nodeWords(n) * sizeof(uint32_t);
+	TrieStats::Level & levelStats = stats.levels[level];
+	++levelStats.nodes[kind];
+	levelStats.bytes[kind] += bytes;
+	++stats.nodes[kind];
+	stats.bytes[kind] += bytes;
+	if (kind == NODE_BUCKET) {
+		++stats.bucketSizes[n[1]];
+		return;
+	}
+	if (kind == NODE_CHAIN) {
+		++stats.chainLengths[n[1]];
+		if (level + n[1] < this->depth) {
+			this->collectStats(n[2], level + n[1], stats);
+		}
+		return;
+	}
+	++levelStats.fanOut[n[1]];
+	if (level + 1 < this->depth) {
+		forEachChild(n, [&](uint32_t, uint32_t slot) {
+			this->collectStats(slot, level + 1, stats);
+		});
+	}
+}
+
+TrieHistograms
+Trie::histograms(bool joint) const {
+	TrieHistograms histograms;
+	histograms.states = this->getNumberOfStates();
+	histograms.values.resize(this->depth);
+	if (this->root != NULL_NODE) {
+		uint32_t key[MAX_KEY_LENGTH];
+		this->collectHistograms(this->root, 0, key, joint, histograms);
+	}
+	return histograms;
+}
+
+// Counts the keys below a slot and returns the number of states there. The
+// keys of the levels above are in `key`.
+uint64_t
+Trie::collectHistograms(
+	uint32_t slot
+	, uint16_t level
+	, uint32_t * key
+	, bool joint
+	, TrieHistograms & histograms
+) const {
+	if (level == this->depth) {
+		return 1;
+	}
+	const uint32_t * n = this->pool.at(slot);
+	if (n[0] == NODE_BUCKET) {
+		// Every entry is a single state
+		for (uint32_t position = 0; position < n[1]; ++position) {
+			std::copy(bucketEntry(n, position), bucketEntry(n, position) + n[3], key + level);
+			for (uint16_t column = 0; column < n[3]; ++column) {
+				this->countValue(level + column, key, 1, joint, histograms);
+			}
+		}
+		return n[1];
+	}
+	if (n[0] == NODE_CHAIN) {
+		std::copy(chainKeys(n), chainKeys(n) + n[1], key + level);
+		uint64_t const states = this->collectHistograms(n[2], level + n[1], key, joint, histograms);
+		for (uint16_t offset = 0; offset < n[1]; ++offset) {
+			this->countValue(level + offset, key, states, joint, histograms);
+		}
+		return states;
+	}
+	uint64_t states = 0;
+	forEachChild(n, [&](uint32_t childKey, uint32_t child) {
+		key[level] = childKey;
+		uint64_t const childStates = this->collectHistograms(child, level + 1, key, joint, histograms);
+		this->countValue(level, key, childStates, joint, histograms);
+		states += childStates;
+	});
+	return states;
+}
+
+// Adds `states` states with the key of `level`, and with the keys of the
+// levels above it for the joint counts
+void
+Trie::countValue(
+	uint16_t level
+	, const uint32_t * key
+	, uint64_t states
+	, bool joint
+	, TrieHistograms & histograms
+) const {
+	uint32_t const species = this->ordering ? this->ordering[level] : level;
+	histograms.values[species][key[level]] += states;
+	if (!joint) {
+		return;
+	}
+	for (uint16_t above = 0; above < level; ++above) {
+		uint32_t const aboveSpecies = this->ordering ? this->ordering[above] : above;
+		if (aboveSpecies < species) {
+			histograms.joint[{ aboveSpecies, species }][{ key[above], key[level] }] += states;
+		}
+		else {
+			histograms.joint[{ species, aboveSpecies }][{ key[level], key[above] }] += states;
+		}
+	}
 }
 
 } // namespace vectormap
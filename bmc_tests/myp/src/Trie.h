@@ -1,33 +1,673 @@
 #ifndef TRIE_H
 #define TRIE_H
 
+#include <functional>
+#include <iostream>
 #include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include "IndexableBitVector.h"
+#include "FrozenTrie.h"
+#include "NodePool.h"
 #include <boost/container/flat_set.hpp>
 
 namespace stamina {
 	namespace core {
 		namespace vectormap {
+			// Most species a state may have. Keys are decoded into buffers of this size.
+			const uint16_t MAX_KEY_LENGTH = 64;
+			// Widest species range that still gets directly indexed child arrays
+			const uint32_t DEFAULT_MAX_DENSE_SPAN = 256;
+			// Ranges up to this size are directly indexed from the first child on
+			const uint32_t DENSE_FROM_START_SPAN = 16;
+			// Largest bucket of burst mode, so that a full bucket fits in a pool chunk
+			const uint32_t MAX_BURST_THRESHOLD = 4096;
+			// Levels that Trie::compact() lays out breadth first by default
+			const uint16_t DEFAULT_BREADTH_FIRST_LEVELS = 4;
+
+			/**
+			 * Kinds of trie nodes. A node changes its kind as children are added,
+			 * so that small nodes stay small and wide nodes stay fast.
+			 * */
+			enum TrieNodeKind : uint32_t {
+				NODE_4 = 0      // up to 4 children, sorted keys
+				, NODE_16       // up to 16 children, sorted keys
+				, NODE_48       // up to 48 children with keys inside of a window of 256 values
+				, NODE_256      // one slot per value of a window of 256 values
+				, NODE_SORTED   // any number of children, sorted keys
+				, NODE_DENSE    // one slot per value of the species range
+				, NODE_CHAIN    // a run of single-child levels collapsed into one key segment
+				, NODE_BUCKET   // sorted list of whole key suffixes, used in burst mode
+				, NODE_BITMAP   // last level only: one bit per value of the species range
+				, NODE_KIND_COUNT
+			};
+
+			const char * nodeKindName(TrieNodeKind kind);
+
+			/**
+			 * Shape of a trie at one point in time, see Trie::stats(). Every
+			 * node is counted on the level it starts at.
+			 * */
+			struct TrieStats {
+				struct Level {
+					Level();
+
+					uint64_t nodes[NODE_KIND_COUNT];
+					uint64_t bytes[NODE_KIND_COUNT];
+					// Number of branching nodes with each number of children
+					std::map<uint32_t, uint64_t> fanOut;
+				};
+
+				TrieStats();
+
+				/**
+				 * Writes one tab separated record per line: "states", "pool"
+				 * with the bytes in use and reserved, "kind" and "level" with
+				 * the nodes and bytes of each node kind, "fanout" with a level,
+				 * a number of children and the nodes that have it, and "chain"
+				 * and "bucket" with a number of keys or entries and the nodes
+				 * that have it. Kinds without nodes are left out.
+				 * */
+				void print(std::ostream & out = std::cout) const;
+
+				uint32_t states;
+				std::size_t bytesInUse;
+				std::size_t bytesReserved;
+				uint64_t nodes[NODE_KIND_COUNT];
+				uint64_t bytes[NODE_KIND_COUNT];
+				std::vector<Level> levels;
+				// Number of chains with each number of keys
+				std::map<uint32_t, uint64_t> chainLengths;
+				// Number of buckets with each number of entries
+				std::map<uint32_t, uint64_t> bucketSizes;
+			};
+
+			/**
+			 * Distribution of the species values over the stored states, see
+			 * Trie::histograms(). Species are numbered in the order they are
+			 * stored in the state, with the trie's ordering undone.
+			 * */
+			struct TrieHistograms {
+				TrieHistograms();
+
+				/**
+				 * Lowest and highest value of each species over the states, in
+				 * the form setSpeciesBounds() takes. Species without states get
+				 * (0, 0).
+				 * */
+				std::vector<std::pair<uint32_t, uint32_t>> bounds() const;
+				/**
+				 * Species from fewest to most distinct values, as an ordering
+				 * for a new trie: levels near the root then branch little, so
+				 * the upper nodes are shared by many states.
+				 * */
+				std::vector<uint32_t> orderingByDistinctValues() const;
+				/**
+				 * Writes one tab separated record per line: "value" with a
+				 * species, a value and the states that have it, and "joint"
+				 * with two species, a value of each and the states that have
+				 * both.
+				 * */
+				void print(std::ostream & out = std::cout) const;
+
+				uint32_t states;
+				// Number of states with each value, per species
+				std::vector<std::map<uint32_t, uint64_t>> values;
+				// Number of states with each pair of values of species (i, j),
+				// i < j, keyed by (i, j). Empty unless asked for.
+				std::map<std::pair<uint32_t, uint32_t>, std::map<std::pair<uint32_t, uint32_t>, uint64_t>> joint;
+			};
+
 			// only works on ints now, maybe use templating later?
+			/**
+			 * Prefix tree over the species counts of a state. All nodes live in a
+			 * NodePool owned by the root and refer to their children through 32-bit
+			 * handles. On the last species level a child slot holds the state index
+			 * itself, so there is no separate node per stored state.
+			 *
+			 * States are first decoded into a key, one value per trie level with
+			 * the species ordering already applied, and the trie is then walked in
+			 * a loop over that key.
+			 *
+			 * Nodes adapt to their fan-out in the style of an adaptive radix tree
+			 * (see TrieNodeKind). Levels whose species has a small known range (see
+			 * setSpeciesBounds()) use directly indexed child arrays once they are
+			 * full enough, so that a child step is a single array index. On the
+			 * last level such species use a bitmap of the range instead, and the
+			 * state index is found by the rank of the key's bit, so a leaf costs
+			 * its index plus a few bits.
+			 *
+			 * Runs of levels where only one key has been seen are stored as one
+			 * NODE_CHAIN holding the whole key segment, radix tree style. A chain
+			 * is split where a new state first differs from it, so species that
+			 * stay constant over large parts of the state space cost neither a
+			 * node nor a pointer step per level.
+			 *
+			 * In burst mode (see setBurstMode()) only the first levels are trie
+			 * levels. Below them the states sharing a prefix keep their remaining
+			 * keys in one sorted NODE_BUCKET, which bursts into a branching node
+			 * with one bucket per child once it is full.
+			 * */
 			class Trie {
-			
+
 				public:
+					// Gets a decoded key, its length and the index of its state
+					typedef std::function<void (const uint32_t * key, uint16_t length, uint32_t index)> StateVisitor;
+
+					/**
+					 * @param max_index Index given to the first inserted state
+					 * @param index Unused, kept for compatibility
+					 * @param ordering Species to use for each trie level. The trie takes
+					 * ownership of the array, which must name every species of the state.
+					 * If null, the species are used in the order they are stored.
+					 * */
 					Trie(uint32_t max_index = 0, uint32_t index = 0, uint32_t * ordering = nullptr);
+					// Syncs the file of a file backed trie
 					~Trie();
 					void printChildren();
-					// TODO: Maybe accept indexableBitVector instead, need help with templating
-					uint32_t get(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
-					bool contains(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
-					uint32_t insert(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
-					uint32_t getNumberOfStates();
-			
+					uint32_t get(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) const;
+					bool contains(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) const;
+					uint32_t insert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0);
+					/**
+					 * Looks up a state and inserts it if it is not stored yet, walking
+					 * the trie only once.
+					 *
+					 * @param stateVector State to look up
+					 * @param pos First species of the state to use
+					 * @return The index of the state and whether it was newly inserted
+					 * */
+					std::pair<uint32_t, bool> findOrInsert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0);
+					uint32_t getNumberOfStates() const;
+					// One more than the largest index given out so far. Indices of
+					// erased states below it are not in use.
+					uint32_t getIndexLimit() const { return this->max_index; }
+					// Bytes held by the nodes
+					std::size_t bytesInUse() const { return this->pool.bytesInUse(); }
+					/**
+					 * @param kind Kind of node to count
+					 * @return Number of nodes of that kind currently in the trie
+					 * */
+					uint64_t getNodeCount(TrieNodeKind kind) const;
+					// Prints one "kind count" line per node kind
+					void printNodeCounts(std::ostream & out = std::cout) const;
+					// Walks all nodes once to collect the node counts, fan-outs,
+					// chain lengths and bytes of every level. See TrieStats.
+					TrieStats stats() const;
+					/**
+					 * Counts the states with each value of each species, and with
+					 * `joint` also with each pair of values of each two species.
+					 * The number of states below every node is worked out on the
+					 * way up, so a key is counted once per node that holds it
+					 * instead of once per state, and no state is decoded.
+					 *
+					 * @param joint Also collect the pairwise counts, which costs a
+					 * map update per node and level above it
+					 * */
+					TrieHistograms histograms(bool joint = false) const;
+
+					/**
+					 * Sets the range of values each species can take. Must be called
+					 * before the first state is inserted. The ranges are only a hint: a
+					 * value outside of its range is still stored correctly, just in a
+					 * slower node.
+					 *
+					 * @param speciesBounds Lowest and highest value of each species, in
+					 * the order the species are stored in the state
+					 * @param maxDenseSpan Widest range that gets directly indexed nodes
+					 * */
+					void setSpeciesBounds(
+						const std::vector<std::pair<uint32_t, uint32_t>> & speciesBounds
+						, uint32_t maxDenseSpan = DEFAULT_MAX_DENSE_SPAN
+					);
+
+					/**
+					 * Sets how many bits the values of each species need, so that the
+					 * sorted nodes of narrow species keep their keys in 8 or 16 bits.
+					 * Must be called before the first state is inserted. Like the
+					 * species bounds, the widths are only a hint: a node that gets a
+					 * wider key moves to wider keys.
+					 *
+					 * @param bitWidths Bits per species, in the order the species are
+					 * stored in the state
+					 * */
+					void setKeyWidths(const std::vector<uint16_t> & bitWidths);
+
+					/**
+					 * Turns on burst mode. Must be called before the first state is
+					 * inserted.
+					 *
+					 * @param prefixLevels Number of levels that never go into buckets
+					 * @param threshold Number of states a bucket holds before it bursts,
+					 * at most `MAX_BURST_THRESHOLD`. Zero turns burst mode off.
+					 * */
+					void setBurstMode(uint16_t prefixLevels, uint32_t threshold);
+
+					/**
+					 * Keeps the nodes in a memory mapped file from now on, so that
+					 * the operating system can page out the parts of the trie that
+					 * are not being walked. Must be called before the first state is
+					 * inserted. Every other call works the same on a file backed trie,
+					 * except that an insertion throws std::runtime_error once the
+					 * file cannot grow, e.g. because the disk is full. The states
+					 * stored before stay, but the one being inserted may be left
+					 * half inserted.
+					 *
+					 * @param path File to create, an existing file is overwritten
+					 * @return Whether the file could be created
+					 * */
+					bool createFile(const std::string & path);
+					/**
+					 * Maps a file written by createFile() and sync() again, with its
+					 * states, indices, ordering and settings. Must be called on a
+					 * newly constructed trie, and the file must not be in use.
+					 *
+					 * @param path File of the trie
+					 * @return Whether the file could be opened and holds a trie
+					 * */
+					bool openFile(const std::string & path);
+					// Writes the state of a file backed trie to its file, so that it
+					// can be reopened. Also done when the trie is destroyed.
+					void sync();
+
+					/**
+					 * Copies all nodes into a new pool in the order lookups walk
+					 * them and drops the old pool, so that the nodes near the root
+					 * share cache lines and the nodes of one path share pages. The
+					 * nodes of the first levels are laid out breadth first, and
+					 * each subtree below them depth first. Node handles change, but
+					 * states keep their indices. A file backed trie is written to a
+					 * new file which then replaces its file.
+					 *
+					 * @param breadthFirstLevels Number of levels laid out breadth first
+					 * @return Whether the new pool could be created, filled and, for
+					 * a file backed trie, moved in place of the old file. If not,
+					 * e.g. because the disk is full, the trie and its file are left
+					 * as they were.
+					 * */
+					bool compact(uint16_t breadthFirstLevels = DEFAULT_BREADTH_FIRST_LEVELS);
+					/**
+					 * Calls compact() after every `inserts` states added, so that
+					 * the layout stays good while the trie grows. Zero turns this off.
+					 * A compaction that fails is reported on std::cerr, and the trie
+					 * goes on with its old layout until the next one is due.
+					 * */
+					void setAutoCompaction(uint32_t inserts);
+
+					/**
+					 * Decodes a state into a key for the key based lookups below.
+					 *
+					 * @param stateVector State to decode
+					 * @param pos First species of the state to use
+					 * @param key Buffer of at least `MAX_KEY_LENGTH` values
+					 * @return Length of the key
+					 * */
+					uint16_t decode(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos, uint32_t * key) const;
+					// Same as the versions above, on an already decoded key
+					uint32_t get(const uint32_t * key, uint16_t length) const;
+					bool contains(const uint32_t * key, uint16_t length) const;
+					std::pair<uint32_t, bool> findOrInsert(const uint32_t * key, uint16_t length);
+
+					/**
+					 * Pins the path of a state, usually the one being expanded, so
+					 * that findOrInsertPinned() can start the walk for its
+					 * successors at the level where they first differ from it
+					 * instead of at the root. The path stays pinned until the next
+					 * call, but an insertion through findOrInsert() unpins it.
+					 *
+					 * @param stateVector State to pin. It does not have to be stored,
+					 * then only the part of its path that is stored is pinned.
+					 * @param pos First species of the state to use
+					 * */
+					void pin(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0);
+					void pin(const uint32_t * key, uint16_t length);
+					/**
+					 * Same as findOrInsert(), but skips the part of the path that the
+					 * state shares with the pinned state.
+					 * */
+					std::pair<uint32_t, bool> findOrInsertPinned(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0);
+					std::pair<uint32_t, bool> findOrInsertPinned(const uint32_t * key, uint16_t length);
+
+					/**
+					 * Removes a state. Nodes that are left without children are
+					 * released, so their memory is reused by later insertions. The
+					 * index of the state is not given out again unless index
+					 * recycling is on, see setIndexRecycling() and renumber().
+					 *
+					 * @param stateVector State to remove
+					 * @param pos First species of the state to use
+					 * @return Whether the state was stored
+					 * */
+					bool erase(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0);
+					bool erase(const uint32_t * key, uint16_t length);
+					// Lets new states take the indices of erased states, the most
+					// recently erased first, before new indices are given out
+					void setIndexRecycling(bool enabled);
+					/**
+					 * Numbers the stored states densely from 0, keeping the order of
+					 * their indices, so that the indices of erased states are not
+					 * left as gaps.
+					 *
+					 * @return The new index of every old index below
+					 * getIndexLimit(), and (uint32_t) -1 for the erased ones
+					 * */
+					std::vector<uint32_t> renumber();
+
+					/**
+					 * Looks up many keys together. Groups of keys walk down the trie
+					 * one node at a time, and the next node of each is prefetched while
+					 * the others take their step, so that their cache misses overlap
+					 * instead of coming one after the other.
+					 *
+					 * @param keys `count` keys of `length` values, one after the other
+					 * @param length Length of each key
+					 * @param count Number of keys
+					 * @param indices Gets the index of each key, or (uint32_t) -1 for
+					 * keys that are not stored
+					 * */
+					void getBatch(const uint32_t * keys, uint16_t length, uint32_t count, uint32_t * indices) const;
+					/**
+					 * Same as calling findOrInsert() on each key in order, but with
+					 * the lookups batched like in getBatch().
+					 *
+					 * @param results Gets the index of each key and whether it was
+					 * newly inserted
+					 * */
+					void findOrInsertBatch(
+						const uint32_t * keys
+						, uint16_t length
+						, uint32_t count
+						, std::pair<uint32_t, bool> * results
+					);
+
+					/**
+					 * Calls `visit` for every stored state, in increasing order of
+					 * the decoded keys. The key buffer is reused between calls.
+					 *
+					 * @param visit Gets the key of each state and its index
+					 * */
+					void forEachState(const StateVisitor & visit) const;
+					/**
+					 * Calls `visit` for every stored state whose species all lie in
+					 * their ranges, in the same order as forEachState(). Subtrees
+					 * are skipped as soon as the key of one level is out of range,
+					 * so only the nodes on paths to a matching state and the nodes
+					 * right below them are looked at.
+					 *
+					 * @param ranges Lowest and highest value of each species, in the
+					 * order the species are stored in the state, like the species
+					 * bounds. Species past the end of the vector take any value.
+					 * @param visit Gets the key of each matching state and its index
+					 * */
+					void forEachStateInRange(
+						const std::vector<std::pair<uint32_t, uint32_t>> & ranges
+						, const StateVisitor & visit
+					) const;
+					// Number of stored states whose species all lie in their ranges
+					uint32_t countStatesInRange(const std::vector<std::pair<uint32_t, uint32_t>> & ranges) const;
+
+					/**
+					 * Set operations with another trie of the same species and
+					 * ordering, e.g. the states of two explorations of a model.
+					 * Both tries are walked together one level at a time, so only
+					 * the paths they share are compared, and a subtree that only
+					 * one of them has is skipped whole unless its states are
+					 * wanted. Each shared path is still compared down to where the
+					 * tries hold the same node, equal chains or equal bucket
+					 * entries, so the cost grows with the shared states, not with
+					 * the difference between the tries. The tries may differ in
+					 * node layout, burst mode and bounds.
+					 *
+					 * The states are added to `result` in increasing key order,
+					 * with the indices it hands out. `result` must not be one of
+					 * the two tries and gets its own settings from the caller, so
+					 * it can e.g. be file-backed.
+					 *
+					 * @param other Trie to combine this one with
+					 * @param result Trie to add the states of the result to
+					 * */
+					void unite(const Trie & other, Trie & result) const;
+					void intersect(const Trie & other, Trie & result) const;
+					// States of this trie that are not in `other`
+					void subtract(const Trie & other, Trie & result) const;
+					/**
+					 * Calls `visit` for the states that the set operations keep,
+					 * in increasing key order, without building a trie. A state in
+					 * both tries comes with its index in this trie, any other with
+					 * its index in the trie it is in.
+					 *
+					 * @param keepShared Visit the states in both tries
+					 * @param keepOwn Visit the states only in this trie
+					 * @param keepOther Visit the states only in `other`
+					 * */
+					void merge(
+						const Trie & other
+						, bool keepShared
+						, bool keepOwn
+						, bool keepOther
+						, const StateVisitor & visit
+					) const;
+					// Sizes of the set operations. The other two follow from the
+					// number of shared states, which are counted like above but
+					// without building their keys. Equal buckets are counted
+					// without walking them.
+					uint32_t countIntersection(const Trie & other) const;
+					uint32_t countUnion(const Trie & other) const;
+					uint32_t countDifference(const Trie & other) const;
+
+					/**
+					 * Turns the reverse lookup of stateOf() on or off. While it is
+					 * on, the trie keeps the node that holds each state index and
+					 * the parent of every node, which costs an index per state and
+					 * a hash map entry per node. Turning it on for a trie that
+					 * already holds states builds both in one pass.
+					 * */
+					void setReverseLookup(bool enabled);
+					/**
+					 * Rebuilds the key of a stored state from the trie, by walking
+					 * from the node holding its index up to the root. Needs the
+					 * reverse lookup to be on.
+					 *
+					 * @param index Index of a stored state
+					 * @param key Buffer of at least `MAX_KEY_LENGTH` values
+					 * @return Length of the key
+					 * */
+					uint16_t stateOf(uint32_t index, uint32_t * key) const;
+					/**
+					 * Same as above, but writes the species values into a state
+					 * with the ordering undone. See IndexableBitVector::encode().
+					 *
+					 * @param state State of the right size to write the values into
+					 * */
+					void stateOf(uint32_t index, CompressedState & state) const;
+
+					/**
+					 * Copies the trie into its succinct read-only form, for when no
+					 * more states will be added. The trie itself is not changed and
+					 * can be dropped afterwards.
+					 *
+					 * @return The frozen trie, which returns the same indices
+					 * */
+					FrozenTrie freeze() const;
+
+					/**
+					 * Walks the stored states in increasing order of their decoded
+					 * keys, like forEachState(), but one state at a time and
+					 * without allocating. It keeps the path to the current state,
+					 * so it must not be used after the trie has changed.
+					 * */
+					class Cursor {
+						public:
+							// Starts at the first state
+							explicit Cursor(const Trie & trie);
+
+							// Whether the cursor is at a state, and not past the last one
+							bool valid() const { return this->frameCount > 0; }
+							// Moves to the next state
+							void next();
+							/**
+							 * Moves to the first state whose key is not less than
+							 * `prefix` on the first `length` levels. Keys starting with
+							 * the prefix come first, so to see whether there are any,
+							 * compare the first levels of key().
+							 *
+							 * @param prefix Decoded key values of the first levels
+							 * @param length Number of values, at most the depth
+							 * @return Whether the cursor is at a state
+							 * */
+							bool seek(const uint32_t * prefix, uint16_t length);
+
+							// Decoded key of the current state, see Trie::decode()
+							const uint32_t * key() const { return this->keys; }
+							uint16_t length() const { return this->trie.depth; }
+							uint32_t index() const { return this->stateIndex; }
+							// Writes the current state with the ordering undone, see
+							// IndexableBitVector::encode()
+							void state(CompressedState & state) const;
+
+						private:
+							// A node on the path to the current state, the level it
+							// starts at, and the position of the current child in it
+							struct Frame {
+								NodeHandle node;
+								uint16_t level;
+								uint32_t position;
+							};
+
+							void settle();
+							void push(NodeHandle node, uint16_t level);
+
+							const Trie & trie;
+							Frame frames[MAX_KEY_LENGTH];
+							uint16_t frameCount;
+							uint32_t keys[MAX_KEY_LENGTH];
+							uint32_t stateIndex;
+					};
+
 				private:
+					friend class FrozenTrie;
+
+					// Range of the keys on one level. A span of zero means unbounded.
+					struct LevelBounds {
+						uint32_t base;
+						uint32_t span;
+					};
+
+					NodeHandle createNode(
+						TrieNodeKind kind
+						, uint32_t size
+						, uint32_t base = 0
+						, uint32_t capacity = 0
+						, uint32_t keyBytes = 4
+					);
+					uint32_t keyBytes(uint16_t level) const;
+					NodeHandle createNode(uint16_t level);
+					void releaseNode(NodeHandle node);
+					NodeHandle addChild(NodeHandle node, uint16_t level, uint32_t key, uint32_t slot);
+					NodeHandle regrow(NodeHandle node, uint16_t level, uint32_t key);
+					NodeHandle createSegment(const uint32_t * keys, uint32_t count, uint32_t slot);
+					uint32_t createChain(const uint32_t * key, uint16_t level, uint16_t length, uint32_t stateIndex);
+					NodeHandle splitChain(
+						NodeHandle chain
+						, uint16_t level
+						, uint32_t divergence
+						, const uint32_t * key
+						, uint16_t length
+						, uint32_t stateIndex
+					);
+					NodeHandle createBucket(uint32_t suffixLength, uint32_t capacity);
+					NodeHandle addEntry(NodeHandle bucket, uint32_t position, const uint32_t * suffix, uint32_t stateIndex);
+					NodeHandle burst(NodeHandle bucket, uint16_t level);
+					const uint32_t * findSlot(const uint32_t * key, uint16_t length) const;
+					std::pair<uint32_t, bool> findOrInsertFrom(
+						NodeHandle * nodeRef
+						, NodeHandle parent
+						, uint16_t level
+						, const uint32_t * key
+						, uint16_t length
+					);
+					void extendPin();
+					void countInsertion();
+					void copyNode(
+						NodePool & target
+						, NodeHandle * nodeRef
+						, uint16_t level
+						, std::vector<std::pair<NodeHandle *, uint16_t>> & children
+					);
+					uint32_t nextIndex();
+					void remapIndices(uint32_t & slot, uint16_t level, const std::vector<uint32_t> & newIndices);
+					void visitStates(uint32_t slot, uint16_t level, uint32_t * key, const StateVisitor & visit) const;
+					void collectStats(NodeHandle node, uint16_t level, TrieStats & stats) const;
+					uint64_t collectHistograms(
+						uint32_t slot
+						, uint16_t level
+						, uint32_t * key
+						, bool joint
+						, TrieHistograms & histograms
+					) const;
+					void countValue(
+						uint16_t level
+						, const uint32_t * key
+						, uint64_t states
+						, bool joint
+						, TrieHistograms & histograms
+					) const;
+					void visitRange(
+						uint32_t slot
+						, uint16_t level
+						, uint32_t * key
+						, const uint32_t * low
+						, const uint32_t * high
+						, const StateVisitor & visit
+					) const;
+					void adopt(NodeHandle node, NodeHandle parent, uint16_t level);
+					void relink(
+						NodeHandle before
+						, NodeHandle after
+						, NodeHandle parent
+						, uint16_t level
+						, uint32_t child
+						, uint16_t childLevel
+					);
+
 					uint32_t index;
-					std::map<uint32_t, std::shared_ptr<Trie>> children;
 					uint32_t max_index;
-					uint32_t * ordering;
+					std::unique_ptr<uint32_t[]> ordering;
+					// Number of levels, fixed by the first inserted state
+					uint16_t depth;
+					std::vector<LevelBounds> levelBounds;
+					// Bytes per key in the sorted nodes of each level: 1, 2 or 4
+					std::vector<uint8_t> levelKeyBytes;
+					// First level that is kept in buckets, and the size at which a
+					// bucket bursts. The threshold is zero if burst mode is off.
+					uint16_t burstLevel;
+					uint32_t burstThreshold;
+					NodeHandle root;
+					NodePool pool;
+					uint64_t nodeCounts[NODE_KIND_COUNT];
+					// Indices of erased states, and whether new states reuse them
+					std::vector<uint32_t> freeIndices;
+					bool recycleIndices;
+					// Inserts between automatic compactions, zero if there are none
+					uint32_t compactionInterval;
+					uint32_t insertsSinceCompaction;
+					// Reverse lookup, see setReverseLookup(): the node holding each
+					// state index, NULL_NODE for unused indices, and the parent of
+					// every node, NULL_NODE for the root
+					bool reverseLookup;
+					std::vector<NodeHandle> leafOf;
+					std::unordered_map<NodeHandle, NodeHandle> parents;
+					// The pinned path, see pin(): where the handle of each of its
+					// nodes is kept and the level that node starts at. The nodes
+					// past the first `pinnedCount` ones are not known. If the path
+					// is not extended, more of it may be stored than is known.
+					std::vector<uint32_t> pinnedKey;
+					NodeHandle * pinnedRefs[MAX_KEY_LENGTH];
+					uint16_t pinnedLevels[MAX_KEY_LENGTH];
+					uint16_t pinnedCount;
+					bool pinExtended;
 			};
 		}
 	}
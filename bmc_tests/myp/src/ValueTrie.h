@@ -0,0 +1,236 @@
+#ifndef STAMINA_CORE_VECTORMAP_VALUETRIE_H
+#define STAMINA_CORE_VECTORMAP_VALUETRIE_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "IndexableBitVector.h"
+#include "Trie.h"
+
+namespace stamina {
+	namespace core {
+		namespace vectormap {
+			/**
+			 * One field of the payload of every state, indexed by state index.
+			 * The values live in chunks of `CHUNK_SIZE` that never move, so the
+			 * column grows without copying values and a reference to a value
+			 * stays valid while more states are added.
+			 *
+			 * @tparam T Type of the field, default constructible
+			 * */
+			template <typename T>
+			class PayloadColumn {
+			public:
+				static const uint8_t CHUNK_BITS = 16;
+				static const uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+
+				PayloadColumn()
+					: limit(0)
+				{ /* Intentionally left empty */ }
+
+				/**
+				 * Makes room for the indices below `limit`. Values in new chunks
+				 * are value initialized, i.e. zero for numbers.
+				 * */
+				void grow(uint32_t limit) {
+					while (this->chunks.size() * CHUNK_SIZE < limit) {
+						this->chunks.emplace_back(new T[CHUNK_SIZE]());
+					}
+					if (limit > this->limit) {
+						this->limit = limit;
+					}
+				}
+
+				T & operator[](uint32_t index) {
+					assert(index < this->limit);
+					return this->chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+				}
+
+				const T & operator[](uint32_t index) const {
+					assert(index < this->limit);
+					return this->chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+				}
+
+				// One more than the largest index there is room for
+				uint32_t size() const { return this->limit; }
+				std::size_t bytesReserved() const { return this->chunks.size() * CHUNK_SIZE * sizeof(T); }
+
+			private:
+				std::vector<std::unique_ptr<T[]>> chunks;
+				uint32_t limit;
+			};
+
+			/**
+			 * Trie that keeps a payload per state, e.g. the reachability
+			 * estimate, frontier flag and exit rate of STAMINA. Each field of the
+			 * payload is a PayloadColumn of its own (structure of arrays), so a
+			 * pass over one field only touches that field's memory. The columns
+			 * are indexed by the state indices of the trie and grow with them.
+			 *
+			 * The states are kept in a Trie, which getTrie() gives read-only for
+			 * queries. The calls that change it are forwarded by this class, so
+			 * that the columns always follow the indices. The payload of a new
+			 * state is value initialized, also when it takes the index of an
+			 * erased state.
+			 * Payloads are not kept in the file of a file backed trie.
+			 *
+			 * @tparam Columns Type of each field of the payload
+			 * */
+			template <typename... Columns>
+			class ValueTrie {
+				static_assert(sizeof...(Columns) > 0, "A payload needs at least one field");
+			public:
+				// References to all fields of the payload of one state
+				typedef std::tuple<Columns &...> Payload;
+				typedef std::tuple<const Columns &...> ConstPayload;
+
+				/**
+				 * @param ordering Species to use for each trie level, see Trie::Trie()
+				 * */
+				explicit ValueTrie(uint32_t * ordering = nullptr)
+					: trie(0, 0, ordering)
+				{ /* Intentionally left empty */ }
+
+				const Trie & getTrie() const { return this->trie; }
+
+				// Settings of the trie, see the Trie calls of the same names
+				void setSpeciesBounds(
+					const std::vector<std::pair<uint32_t, uint32_t>> & speciesBounds
+					, uint32_t maxDenseSpan = DEFAULT_MAX_DENSE_SPAN
+				) {
+					this->trie.setSpeciesBounds(speciesBounds, maxDenseSpan);
+				}
+				void setKeyWidths(const std::vector<uint16_t> & bitWidths) { this->trie.setKeyWidths(bitWidths); }
+				void setBurstMode(uint16_t prefixLevels, uint32_t threshold) { this->trie.setBurstMode(prefixLevels, threshold); }
+				void setIndexRecycling(bool enabled) { this->trie.setIndexRecycling(enabled); }
+				void setAutoCompaction(uint32_t inserts) { this->trie.setAutoCompaction(inserts); }
+				// States keep their indices, so the payloads stay where they are
+				bool compact(uint16_t breadthFirstLevels = DEFAULT_BREADTH_FIRST_LEVELS) { return this->trie.compact(breadthFirstLevels); }
+				void pin(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) { this->trie.pin(stateVector, pos); }
+				void pin(const uint32_t * key, uint16_t length) { this->trie.pin(key, length); }
+
+				/**
+				 * Same as Trie::findOrInsert(), but also makes room for the
+				 * payload of a new state and resets it.
+				 * */
+				std::pair<uint32_t, bool> findOrInsert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) {
+					return this->added(this->trie.findOrInsert(stateVector, pos));
+				}
+				std::pair<uint32_t, bool> findOrInsert(const uint32_t * key, uint16_t length) {
+					return this->added(this->trie.findOrInsert(key, length));
+				}
+				std::pair<uint32_t, bool> findOrInsertPinned(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) {
+					return this->added(this->trie.findOrInsertPinned(stateVector, pos));
+				}
+				std::pair<uint32_t, bool> findOrInsertPinned(const uint32_t * key, uint16_t length) {
+					return this->added(this->trie.findOrInsertPinned(key, length));
+				}
+
+				/**
+				 * Looks up a state, inserting it if it is not stored yet, and
+				 * returns its payload, so that it can be updated in place, e.g.
+				 * `std::get<0>(trie.payloadOf(state)) += probability`.
+				 * */
+				Payload payloadOf(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) {
+					return this->payload(this->findOrInsert(stateVector, pos).first);
+				}
+				Payload payloadOf(const uint32_t * key, uint16_t length) {
+					return this->payload(this->findOrInsert(key, length).first);
+				}
+
+				/**
+				 * @param index Index of a stored state
+				 * @return References to the fields of its payload, valid until
+				 * the state is erased or renumber() is called
+				 * */
+				Payload payload(uint32_t index) {
+					return this->payload(index, std::index_sequence_for<Columns...>());
+				}
+				ConstPayload payload(uint32_t index) const {
+					return this->payload(index, std::index_sequence_for<Columns...>());
+				}
+
+				// A whole field, for passes over all states
+				template <std::size_t Field>
+				PayloadColumn<typename std::tuple_element<Field, std::tuple<Columns...>>::type> & column() {
+					return std::get<Field>(this->columns);
+				}
+				template <std::size_t Field>
+				const PayloadColumn<typename std::tuple_element<Field, std::tuple<Columns...>>::type> & column() const {
+					return std::get<Field>(this->columns);
+				}
+
+				bool erase(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos = 0) {
+					return this->trie.erase(stateVector, pos);
+				}
+				bool erase(const uint32_t * key, uint16_t length) {
+					return this->trie.erase(key, length);
+				}
+
+				/**
+				 * Same as Trie::renumber(), and moves each payload along with
+				 * its state.
+				 * */
+				std::vector<uint32_t> renumber() {
+					std::vector<uint32_t> newIndices = this->trie.renumber();
+					this->move(newIndices, std::index_sequence_for<Columns...>());
+					return newIndices;
+				}
+
+				// Bytes held by the trie nodes and the payload columns
+				std::size_t bytesInUse() const {
+					return this->trie.bytesInUse() + this->columnBytes(std::index_sequence_for<Columns...>());
+				}
+
+			private:
+				std::pair<uint32_t, bool> added(std::pair<uint32_t, bool> indexAndInserted) {
+					if (indexAndInserted.second) {
+						this->grow(indexAndInserted.first, std::index_sequence_for<Columns...>());
+					}
+					return indexAndInserted;
+				}
+
+				// Makes room for the payload of a new state and resets it
+				template <std::size_t... Fields>
+				void grow(uint32_t index, std::index_sequence<Fields...>) {
+					(std::get<Fields>(this->columns).grow(index + 1), ...);
+					((std::get<Fields>(this->columns)[index] = Columns()), ...);
+				}
+
+				template <std::size_t... Fields>
+				Payload payload(uint32_t index, std::index_sequence<Fields...>) {
+					return Payload(std::get<Fields>(this->columns)[index]...);
+				}
+
+				template <std::size_t... Fields>
+				ConstPayload payload(uint32_t index, std::index_sequence<Fields...>) const {
+					return ConstPayload(std::get<Fields>(this->columns)[index]...);
+				}
+
+				// New indices are never larger than the old ones, so moving the
+				// payloads in increasing order of the old indices is safe
+				template <std::size_t... Fields>
+				void move(const std::vector<uint32_t> & newIndices, std::index_sequence<Fields...>) {
+					for (uint32_t index = 0; index < newIndices.size(); ++index) {
+						if (newIndices[index] != (uint32_t) -1 && newIndices[index] != index) {
+							((std::get<Fields>(this->columns)[newIndices[index]] = std::move(std::get<Fields>(this->columns)[index])), ...);
+						}
+					}
+				}
+
+				template <std::size_t... Fields>
+				std::size_t columnBytes(std::index_sequence<Fields...>) const {
+					return (std::get<Fields>(this->columns).bytesReserved() + ...);
+				}
+
+				Trie trie;
+				std::tuple<PayloadColumn<Columns>...> columns;
+			};
+		} // namespace vectormap
+	} // namespace core
+} // namespace stamina
+#endif // STAMINA_CORE_VECTORMAP_VALUETRIE_H
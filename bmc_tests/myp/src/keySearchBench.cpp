@@ -0,0 +1,194 @@
+/**
+ * Microbenchmark of the kernels in KeySearch.h on the sorted child keys of
+ * mid-sized trie nodes.
+ *
+ * The keys are modeled on the species of the given PRISM models: a node
+ * holds the counts of one species around its initial count, spaced by the
+ * step its reactions change it by. Lookups are a mix of keys in the node and
+ * counts the node does not have. Every kernel is run with 32-bit keys, and
+ * with 8 and 16-bit keys where the counts fit.
+ *
+ * Usage: keySearchBench [lookups] model.sm [model.sm ...]
+ * */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "KeySearch.h"
+
+using namespace stamina::core::vectormap;
+
+// How the counts of one species are spread out
+struct SpeciesKeys {
+	std::string name;
+	uint32_t init;
+	uint32_t step;
+	uint32_t highest;
+};
+
+// Reads the integer variables of a model, with their initial value, upper
+// bound and the largest step any update changes them by
+std::vector<SpeciesKeys>
+readSpecies(const std::string & filename) {
+	std::ifstream file(filename);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::string const text = contents.str();
+
+	std::map<std::string, uint32_t> constants;
+	std::regex const constant("const\\s+int\\s+(\\w+)\\s*=\\s*(\\d+)");
+	for (std::sregex_iterator it(text.begin(), text.end(), constant), end; it != end; ++it) {
+		constants[(*it)[1]] = std::stoul((*it)[2]);
+	}
+
+	std::vector<SpeciesKeys> species;
+	std::regex const variable("(\\w+)\\s*:\\s*(?:int|\\[\\s*\\w+\\s*\\.\\.\\s*(\\w+)\\s*\\])\\s*init\\s+(\\d+)");
+	for (std::sregex_iterator it(text.begin(), text.end(), variable), end; it != end; ++it) {
+		SpeciesKeys keys = { (*it)[1], (uint32_t) std::stoul((*it)[3]), 1, UINT32_MAX / 2 };
+		std::string const upper = (*it)[2];
+		if (!upper.empty()) {
+			keys.highest = std::isdigit(upper[0]) ? std::stoul(upper)
+				: constants.count(upper) ? constants[upper]
+				: keys.highest;
+		}
+		std::regex const update("\\(\\s*" + keys.name + "'\\s*=\\s*" + keys.name + "\\s*[-+]\\s*(\\d+)\\s*\\)");
+		for (std::sregex_iterator u(text.begin(), text.end(), update); u != end; ++u) {
+			keys.step = std::max(keys.step, (uint32_t) std::stoul((*u)[1]));
+		}
+		species.push_back(keys);
+	}
+	return species;
+}
+
+// Sorted keys of a node with `size` children of one species
+std::vector<uint32_t>
+nodeKeys(const SpeciesKeys & species, uint32_t size) {
+	uint64_t const below = (uint64_t) species.step * (size / 2);
+	uint64_t lowest = species.init > below ? species.init - below : 0;
+	if (lowest + (uint64_t) species.step * (size - 1) > species.highest) {
+		uint64_t const span = (uint64_t) species.step * (size - 1);
+		lowest = species.highest > span ? species.highest - span : 0;
+	}
+	std::vector<uint32_t> keys;
+	for (uint32_t i = 0; i < size; i++) {
+		keys.push_back(lowest + (uint64_t) species.step * i);
+	}
+	return keys;
+}
+
+// Runs `lookups` searches with one kernel on keys narrowed to KeyT. Returns
+// nanoseconds per search, and the sum of the results in `checksum`.
+template <typename KeyT>
+double
+timeKernel(
+	KeySearchKernel kernel
+	, const std::vector<std::vector<uint32_t>> & wideNodes
+	, const std::vector<std::pair<uint32_t, uint32_t>> & queries
+	, uint32_t lookups
+	, uint64_t & checksum
+) {
+	std::vector<std::vector<KeyT>> nodes;
+	for (auto const & keys : wideNodes) {
+		nodes.emplace_back(keys.begin(), keys.end());
+	}
+	KeySearchFunction<KeyT> search = keySearchFunction<KeyT>(kernel);
+	checksum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < lookups; i++) {
+		auto const & query = queries[i % queries.size()];
+		auto const & keys = nodes[query.first];
+		checksum += search(keys.data(), keys.size(), (KeyT) query.second);
+	}
+	std::chrono::duration<double, std::nano> time = std::chrono::high_resolution_clock::now() - start;
+	return time.count() / lookups;
+}
+
+int
+main(int argc, char ** argv) {
+	int first = 1;
+	uint32_t lookups = 1 << 22;
+	if (argc > 1 && std::isdigit(argv[1][0])) {
+		lookups = std::strtoul(argv[1], nullptr, 10);
+		first = 2;
+	}
+	if (first >= argc) {
+		std::cerr << "Usage: " << argv[0] << " [lookups] model.sm [model.sm ...]" << std::endl;
+		return 1;
+	}
+
+	std::cout << "Best kernel on this CPU: " << keySearchKernelName(bestKeySearchKernel()) << std::endl;
+	std::cout << "model\tkeys\tbits";
+	for (int kernel = 0; kernel < KEY_SEARCH_KERNEL_COUNT; kernel++) {
+		std::cout << "\t" << keySearchKernelName((KeySearchKernel) kernel) << " (ns)";
+	}
+	std::cout << std::endl;
+
+	std::mt19937 random(42);
+	for (int arg = first; arg < argc; arg++) {
+		std::vector<SpeciesKeys> species = readSpecies(argv[arg]);
+		if (species.empty()) {
+			std::cerr << "No integer variables found in " << argv[arg] << std::endl;
+			continue;
+		}
+		for (uint32_t size = 8; size <= 64; size *= 2) {
+			// One node per species, and lookups spread over all of them
+			std::vector<std::vector<uint32_t>> nodes;
+			uint32_t highest = 0;
+			for (auto const & s : species) {
+				nodes.push_back(nodeKeys(s, size));
+				highest = std::max(highest, nodes.back().back());
+			}
+			std::vector<std::pair<uint32_t, uint32_t>> queries;
+			for (uint32_t i = 0; i < 4096; i++) {
+				uint32_t node = random() % nodes.size();
+				uint32_t key = nodes[node][random() % size];
+				// About one in four lookups misses
+				if (random() % 4 == 0) {
+					key += species[node].step > 1 ? 1 : size;
+				}
+				queries.emplace_back(node, key);
+				highest = std::max(highest, key);
+			}
+
+			// Each key width the keys of these nodes fit into
+			for (uint32_t bits = 8; bits <= 32; bits *= 2) {
+				if (bits < 32 && highest >> bits != 0) {
+					continue;
+				}
+				std::cout << argv[arg] << "\t" << size << "\t" << bits;
+				uint64_t expected = 0;
+				for (int kernel = 0; kernel < KEY_SEARCH_KERNEL_COUNT; kernel++) {
+					if (!keySearchKernelSupported((KeySearchKernel) kernel)) {
+						std::cout << "\t-";
+						continue;
+					}
+					uint64_t checksum;
+					double time = bits == 8 ? timeKernel<uint8_t>((KeySearchKernel) kernel, nodes, queries, lookups, checksum)
+						: bits == 16 ? timeKernel<uint16_t>((KeySearchKernel) kernel, nodes, queries, lookups, checksum)
+						: timeKernel<uint32_t>((KeySearchKernel) kernel, nodes, queries, lookups, checksum);
+					if (kernel == KEY_SEARCH_SCALAR) {
+						expected = checksum;
+					}
+					else if (checksum != expected) {
+						std::cerr << keySearchKernelName((KeySearchKernel) kernel) << " disagrees with the scalar search!" << std::endl;
+						return 1;
+					}
+					std::cout << "\t" << time;
+				}
+				std::cout << std::endl;
+			}
+		}
+	}
+	return 0;
+}
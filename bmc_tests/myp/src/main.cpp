@@ -15,10 +15,13 @@
 #include <vector>
 #include <queue>
 #include <cassert>
+#include <algorithm>
 
 #include "memMan.h"
 #include "IndexableBitVector.h"
 #include "Trie.h"
+#include "FixedTrie.h"
+#include "Mdd.h"
 
 #include <storm/api/storm.h>
 #include <storm-parsers/api/storm-parsers.h>
@@ -103,9 +106,48 @@ void doExploration(Settings & settings) {
 	//   c) Storm's BitVectorHashMap
 	auto ordering = settings.orderingToArray(); //
 	Trie stateStorage(0, 0, ordering);
+	stateStorage.setSpeciesBounds(settings.boundsToVector(), settings.maxDenseSpan);
+	stateStorage.setKeyWidths(State::keyBitWidths());
+	stateStorage.setBurstMode(settings.burstLevels, settings.burstThreshold);
+	stateStorage.setAutoCompaction(settings.compactInterval);
+	if (!settings.trieFile.empty() && !stateStorage.createFile(settings.trieFile)) {
+		std::cerr << "Could not create " << settings.trieFile << ", keeping the trie in memory" << std::endl;
+	}
+
+	// With settings.useFixedTrie the states go into the FixedTrie for this
+	// number of species instead. The Trie is still used to decode states.
+	// Models with more species than there are instantiations use the Trie.
+	std::unique_ptr<stamina::core::vectormap::FixedTrieBase> fixedStorage;
+	if (settings.useFixedTrie) {
+		auto const widths = State::keyBitWidths();
+		uint16_t const keyBits = widths.empty() ? 32 : *std::max_element(widths.begin(), widths.end());
+		fixedStorage = stamina::core::vectormap::makeFixedTrie(widths.size(), keyBits);
+		if (!fixedStorage) {
+			std::cerr << "No FixedTrie for " << widths.size() << " species, using the Trie" << std::endl;
+		}
+	}
 
 	// A simple exploration queue
 	std::deque<CompressedState> explorationQueue;
+	// With settings.queueIndices the queue holds state indices instead, and
+	// each state is rebuilt from the trie when it is expanded. The bits the
+	// trie does not store are taken from the first state.
+	bool const queueIndices = settings.queueIndices && !fixedStorage;
+	std::deque<uint32_t> indexQueue;
+	CompressedState stateTemplate;
+	if (queueIndices) {
+		stateStorage.setReverseLookup(true);
+	}
+	auto const enqueue = [&](const CompressedState & state, uint32_t idx) {
+		if (!queueIndices) {
+			explorationQueue.push_back(state);
+			return;
+		}
+		if (stateTemplate.size() == 0) {
+			stateTemplate = state;
+		}
+		indexQueue.push_back(idx);
+	};
 
 	// Some vectors to store lookup and insertion times
 	std::vector<LookupTime> lookupTimes;
@@ -118,6 +160,22 @@ void doExploration(Settings & settings) {
 
 	storm::generator::CompressedState * oldState = nullptr;
 
+	// With settings.batchLookups, the successors of an expansion are only
+	// collected by the callback, which hands out placeholder ids for them.
+	// They are looked up in one batch after the expansion and the
+	// placeholders are replaced by the real ids.
+	bool const batchLookups = settings.batchLookups;
+	bool collectingSuccessors = false;
+	uint32_t const PLACEHOLDER_BIT = 0x80000000;
+	std::vector<uint32_t> pendingKeys;
+	std::vector<CompressedState> pendingStates;
+	std::vector<std::pair<uint32_t, bool>> pendingResults;
+	uint16_t keyLength = 0;
+
+	// With settings.pinnedLookups, the successors of an expansion are looked
+	// up from the trie path of the state being expanded
+	bool const pinnedLookups = settings.pinnedLookups && !fixedStorage && !batchLookups;
+
 	// Create a lambda (closure) that returns the last value of stateCnt and then increments it.
 	// This is our "stateToIdCallback", which is crucial for how Storm does state expansion.
 	// It is called for each new state in both NextStateGenerator::getInitialStates, and in
@@ -150,57 +208,110 @@ void doExploration(Settings & settings) {
 		// idxableState.printIntegerVariables();
 		// std::cout << std::endl;
 
-		// Measure lookup time here. If using Storm's bit vector hashmap
-		// you should pass that in instead of idxableState
+		if (collectingSuccessors) {
+			std::size_t const offset = pendingKeys.size();
+			pendingKeys.resize(offset + stamina::core::vectormap::MAX_KEY_LENGTH);
+			keyLength = stateStorage.decode(idxableState, 0, pendingKeys.data() + offset);
+			pendingKeys.resize(offset + keyLength);
+			pendingStates.push_back(state);
+			return PLACEHOLDER_BIT | (uint32_t) (pendingStates.size() - 1);
+		}
+
+		// Measure lookup time here. The lookup and the insertion of a new
+		// state happen in the same walk down the trie, so for new states
+		// this time is recorded as both a lookup and an insertion.
 		auto startTime = std::chrono::high_resolution_clock::now();
-		bool stateExists = stateStorage.contains(idxableState, 0);
+		std::pair<uint32_t, bool> indexAndInserted;
+		if (fixedStorage) {
+			uint32_t key[stamina::core::vectormap::MAX_KEY_LENGTH];
+			stateStorage.decode(idxableState, 0, key);
+			indexAndInserted = fixedStorage->findOrInsert(key);
+		}
+		else if (pinnedLookups && oldState != nullptr) {
+			indexAndInserted = stateStorage.findOrInsertPinned(idxableState, 0);
+		}
+		else {
+			indexAndInserted = stateStorage.findOrInsert(idxableState, 0);
+		}
 		auto lookupTime = std::chrono::high_resolution_clock::now() - startTime;
 
+		bool stateExists = !indexAndInserted.second;
 		// Store this lookup time in our vector
-		// Note that some datastructures may not provide a `contains` function,
-		// and instead you can tell if it's in the set by the `get()` being equal
-		// to the `end()` function or not.
 		lookupTimes.push_back(LookupTime(lookupTime, stateCnt, stateExists));
 		// If lookup was successful, we don't need to go any further
 		if (stateExists) {
-			return stateStorage.get(idxableState, 0);
+			return indexAndInserted.first;
 		}
 		// This could be encoded in an invariant if in Rust or dafny
 		// assert(stateStorage.getNumberOfStates() == stateCnt);
 		// std::cout << "stateStorage.getNumberOfStates()=" << stateStorage.getNumberOfStates() << ", stateCnt=" << stateCnt << std::endl;
 		// Enqueue new states to be explored
-		explorationQueue.push_back(state);
+		enqueue(state, indexAndInserted.first);
 
 		uint32_t idx = stateCnt++;
 
-		// Time insertion
-		startTime = std::chrono::high_resolution_clock::now();
-		uint32_t newStateIndex = stateStorage.insert(idxableState, 0) - 1;
-		auto insertTime = std::chrono::high_resolution_clock::now() - startTime;
-
 		// Store our insertion times in the vector defined above
-		insertTimes.push_back(InsertTime(insertTime, stateCnt));
+		insertTimes.push_back(InsertTime(lookupTime, stateCnt));
 
-		assert(idx == newStateIndex);
-		// std::cout << "idx=" << idx << ", newStateIndex=" << newStateIndex << std::endl;
+		assert(idx == indexAndInserted.first);
 		// If not in the state storage, return the last value of stateCnt
 		return idx;
 	});
 
 	auto initStateIndexes = generator->getInitialStates(stateToIdCallback);
+	uint32_t nextStats = settings.statsInterval;
 
-	while (!explorationQueue.empty() && stateCnt <= maxNumToExplore) {
+	while ((!explorationQueue.empty() || !indexQueue.empty()) && stateCnt <= maxNumToExplore) {
 		// All this loop needs to do is expand and enqueue the next states
-		auto curState = explorationQueue.front();
-		explorationQueue.pop_front();
+		CompressedState curState;
+		if (queueIndices) {
+			curState = stateTemplate;
+			stateStorage.stateOf(indexQueue.front(), curState);
+			indexQueue.pop_front();
+		}
+		else {
+			curState = explorationQueue.front();
+			explorationQueue.pop_front();
+		}
 		// Load the state to expand its successors
 		generator->load(curState);
+		if (pinnedLookups) {
+			stateStorage.pin(State(curState), 0);
+		}
 
 		// for filtering purposes
 		oldState = &curState;
 
 		// Expand the state (this enqueues its successors)
+		collectingSuccessors = batchLookups;
 		auto behavior = generator->expand(stateToIdCallback);
+		collectingSuccessors = false;
+
+		if (!pendingStates.empty()) {
+			pendingResults.resize(pendingStates.size());
+			auto startTime = std::chrono::high_resolution_clock::now();
+			if (fixedStorage) {
+				for (std::size_t i = 0; i < pendingStates.size(); i++) {
+					pendingResults[i] = fixedStorage->findOrInsert(pendingKeys.data() + i * keyLength);
+				}
+			}
+			else {
+				stateStorage.findOrInsertBatch(pendingKeys.data(), keyLength, pendingStates.size(), pendingResults.data());
+			}
+			// Only the time of the whole batch is known, so it is split evenly
+			auto lookupTime = (std::chrono::high_resolution_clock::now() - startTime) / pendingStates.size();
+			for (std::size_t i = 0; i < pendingStates.size(); i++) {
+				bool stateExists = !pendingResults[i].second;
+				lookupTimes.push_back(LookupTime(lookupTime, stateCnt, stateExists));
+				if (stateExists) {
+					continue;
+				}
+				enqueue(pendingStates[i], pendingResults[i].first);
+				uint32_t idx = stateCnt++;
+				insertTimes.push_back(InsertTime(lookupTime, stateCnt));
+				assert(idx == pendingResults[i].first);
+			}
+		}
 
 		// Deterministic models should only have one choice
 		for (auto const & choice : behavior) {
@@ -208,6 +319,9 @@ void doExploration(Settings & settings) {
 				// I don't know if you need these, but this is how you get
 				// the index and probability of each successor.
 				auto successorIdx        = stateProbabilityPair.first;
+				if (successorIdx != (uint32_t) -1 && (successorIdx & PLACEHOLDER_BIT)) {
+					successorIdx = pendingResults[successorIdx & ~PLACEHOLDER_BIT].first;
+				}
 				auto propensityOrProbability = stateProbabilityPair.second;
 				// If you need the state values here, you
 				// will have to maintain an array of state references
@@ -216,6 +330,14 @@ void doExploration(Settings & settings) {
 				// That is not shown here for brevity sake.
 			}
 		}
+		pendingKeys.clear();
+		pendingStates.clear();
+
+		if (settings.statsInterval != 0 && !fixedStorage && stateCnt >= nextStats) {
+			std::cout << "trie stats at\t" << stateCnt << std::endl;
+			stateStorage.stats().print();
+			nextStats = stateCnt + settings.statsInterval;
+		}
 	}
 
 	// You probably want to store the results from your test here
@@ -269,6 +391,44 @@ void doExploration(Settings & settings) {
 	std::cout << "average time: " << totalTime / (double)totalCount << std::endl;
 	print_pages();
 
+	std::cout << "\n\n"<< std::endl;
+	std::cout << "trie node kinds" << std::endl;
+	stateStorage.printNodeCounts();
+	if (!fixedStorage && settings.compactTrie) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		stateStorage.compact();
+		std::chrono::duration<double> compactTime = std::chrono::high_resolution_clock::now() - startTime;
+		std::cout << "compaction time: " << compactTime.count() << std::endl;
+	}
+	if (fixedStorage) {
+		std::cout << "fixed trie bytes: " << fixedStorage->bytesInUse() << std::endl;
+	}
+	else if (settings.buildDiagram) {
+		stamina::core::vectormap::Mdd diagram(stateStorage);
+		std::cout << "mdd nodes: " << diagram.getNodeCount() << "\t";
+		std::cout << "mdd bytes: " << diagram.bytesInUse() << std::endl;
+	}
+	if (!fixedStorage && settings.freezeTrie) {
+		auto frozen = stateStorage.freeze();
+		std::cout << "frozen trie nodes: " << frozen.getNodeCount() << "\t";
+		std::cout << "frozen trie bytes: " << frozen.bytesInUse() << std::endl;
+	}
+	if (!fixedStorage && !settings.targetRanges.empty()) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		uint32_t targetStates = stateStorage.countStatesInRange(settings.targetRangesToVector());
+		std::chrono::duration<double> queryTime = std::chrono::high_resolution_clock::now() - startTime;
+		std::cout << "target states: " << targetStates << "\t";
+		std::cout << "range query time: " << queryTime.count() << std::endl;
+	}
+	if (!fixedStorage && settings.printHistograms) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		auto histograms = stateStorage.histograms(settings.jointHistograms);
+		std::chrono::duration<double> histogramTime = std::chrono::high_resolution_clock::now() - startTime;
+		std::cout << "species histograms" << std::endl;
+		histograms.print();
+		std::cout << "histogram time: " << histogramTime.count() << std::endl;
+	}
+
 	std::cout << "\n\n"<< std::endl;
 }
 
@@ -1,10 +1,21 @@
 #define BOOST_TEST_MAIN
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <iterator>
 
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
+#include <sys/resource.h>
+#include <sys/stat.h>
+
 #include <storm/api/storm.h>
 #include <storm-parsers/api/storm-parsers.h>
 #include <storm-parsers/parser/PrismParser.h>
@@ -13,12 +24,18 @@
 #include <storm/generator/PrismNextStateGenerator.h>
 #include <storm/utility/initialize.h>
 
+#include "FixedTrie.h"
 #include "IndexableBitVector.h"
+#include "KeySearch.h"
+#include "Mdd.h"
 #include "Trie.h"
+#include "ValueTrie.h"
 #include "util.h"
 
 #define NUM_STATES 50000
 #define MAX_LEN 10
+// Shortest state for the tests that need NUM_STATES distinct states
+#define MIN_UNIQUE_LEN 3
 
 typedef stamina::core::vectormap::Trie Trie;
 
@@ -72,7 +89,7 @@ createUniqueRandomState(
 			uint_fast64_t bitIndex = i * sliceSize;
 			s.setFromInt(bitIndex, sliceSize, rVec[i]);
 		}
-	} while (!classicStateStorage.stateToId.contains(s));
+	} while (classicStateStorage.stateToId.contains(s));
 	classicStateStorage.stateToId.findOrAdd(s, stateId);
 	states.push_back(s);
 	return State(states[states.size() - 1]);
@@ -116,7 +133,7 @@ BOOST_AUTO_TEST_CASE( mainTestSweep ) {
  * */
 BOOST_AUTO_TEST_CASE( insertionTest ) {
 	uint32_t state_count = 0;
-	uint32_t len_states = rand() % MAX_LEN + 1;
+	uint32_t len_states = rand() % (MAX_LEN - MIN_UNIQUE_LEN + 1) + MIN_UNIQUE_LEN;
 	Trie stateStorage;
 	storm::storage::sparse::StateStorage<uint32_t> classicStateStorage(len_states * 8 * sizeof(uint32_t));
 	for (int i = 0; i < NUM_STATES; i++) {
@@ -140,7 +157,7 @@ BOOST_AUTO_TEST_CASE( insertionTest ) {
  * */
 BOOST_AUTO_TEST_CASE( multiSearchTest ) {
 	uint32_t state_count = 0;
-	uint32_t len_states = rand() % MAX_LEN + 1;
+	uint32_t len_states = rand() % (MAX_LEN - MIN_UNIQUE_LEN + 1) + MIN_UNIQUE_LEN;
 	uint32_t TIMES_TO_SEARCH = 5;
 	Trie stateStorage;
 	storm::storage::sparse::StateStorage<uint32_t> classicStateStorage(len_states * 8 * sizeof(uint32_t));
@@ -165,7 +182,7 @@ BOOST_AUTO_TEST_CASE( multiSearchTest ) {
  * */
 BOOST_AUTO_TEST_CASE( multiInsertTest ) {
 	uint32_t state_count = 0;
-	uint32_t len_states = rand() % MAX_LEN + 1;
+	uint32_t len_states = rand() % (MAX_LEN - MIN_UNIQUE_LEN + 1) + MIN_UNIQUE_LEN;
 	uint32_t TIMES_TO_INSERT = 5;
 	Trie stateStorage;
 	storm::storage::sparse::StateStorage<uint32_t> classicStateStorage(len_states * 8 * sizeof(uint32_t));
@@ -191,7 +208,7 @@ BOOST_AUTO_TEST_CASE( multiInsertTest ) {
  * */
 BOOST_AUTO_TEST_CASE( dneTest ) {
 	uint32_t state_count = 0;
-	uint32_t len_states = rand() % MAX_LEN + 1;
+	uint32_t len_states = rand() % (MAX_LEN - MIN_UNIQUE_LEN + 1) + MIN_UNIQUE_LEN;
 	Trie stateStorage;
 	storm::storage::sparse::StateStorage<uint32_t> classicStateStorage(len_states * 8 * sizeof(uint32_t));
 	for (int i = 0; i < NUM_STATES; i++) {
@@ -203,3 +220,1212 @@ BOOST_AUTO_TEST_CASE( dneTest ) {
 		stateStorage.insert(state);
 	}
 }
+
+/**
+ * Tests that findOrInsert() hands out new indices exactly once and finds
+ * the same index again afterwards.
+ * */
+BOOST_AUTO_TEST_CASE( findOrInsertTest ) {
+	uint32_t state_count = 0;
+	uint32_t len_states = rand() % (MAX_LEN - MIN_UNIQUE_LEN + 1) + MIN_UNIQUE_LEN;
+	Trie stateStorage;
+	storm::storage::sparse::StateStorage<uint32_t> classicStateStorage(len_states * 8 * sizeof(uint32_t));
+	for (int i = 0; i < NUM_STATES; i++) {
+		uint32_t stateId = state_count++;
+		State state = createUniqueRandomState(len_states, classicStateStorage, stateId);
+		auto inserted = stateStorage.findOrInsert(state);
+		BOOST_TEST(inserted.second
+				, "State with id " << stateId << " should have been inserted!");
+		BOOST_TEST(inserted.first == stateId
+				, "Should have gotten same state IDs!"
+				<< inserted.first << " ?== " << stateId);
+		auto found = stateStorage.findOrInsert(state);
+		BOOST_TEST(!found.second
+				, "State with id " << stateId << " should not be inserted twice!");
+		BOOST_TEST(found.first == stateId
+				, "Should have gotten same state IDs!"
+				<< found.first << " ?== " << stateId);
+	}
+	BOOST_TEST(stateStorage.getNumberOfStates() == state_count);
+}
+
+/**
+ * Tests that applying a species ordering does not change which index a
+ * state gets, and that the decoded key finds the same state.
+ * */
+BOOST_AUTO_TEST_CASE( orderingTest ) {
+	uint32_t len_states = rand() % MAX_LEN + 1;
+	uint32_t * ordering = new uint32_t[len_states];
+	for (uint32_t i = 0; i < len_states; i++) {
+		ordering[i] = len_states - 1 - i;
+	}
+	Trie stateStorage;
+	Trie orderedStateStorage(0, 0, ordering);
+	for (int i = 0; i < NUM_STATES; i++) {
+		State state = createRandomState(len_states);
+		auto unordered = stateStorage.findOrInsert(state);
+		auto ordered = orderedStateStorage.findOrInsert(state);
+		BOOST_TEST((unordered == ordered)
+				, "Ordering should not change the index! "
+				<< unordered.first << " ?== " << ordered.first);
+		uint32_t key[stamina::core::vectormap::MAX_KEY_LENGTH];
+		uint16_t length = orderedStateStorage.decode(state, 0, key);
+		BOOST_TEST(key[0] == state[len_states - 1]);
+		BOOST_TEST(orderedStateStorage.get(key, length) == ordered.first);
+	}
+	states.clear();
+}
+
+/**
+ * Tests that a trie with directly indexed levels gives the same indices as
+ * one without, including for values outside of the given bounds.
+ * */
+BOOST_AUTO_TEST_CASE( speciesBoundsTest ) {
+	uint32_t len_states = rand() % MAX_LEN + 1;
+	std::vector<std::pair<uint32_t, uint32_t>> bounds;
+	for (uint32_t i = 0; i < len_states; i++) {
+		// createRandomVector() draws values below 100, so some of these are too tight
+		bounds.emplace_back(0, i % 2 == 0 ? 99 : 9);
+	}
+	Trie stateStorage;
+	Trie boundedStateStorage;
+	boundedStateStorage.setSpeciesBounds(bounds);
+	for (int i = 0; i < NUM_STATES; i++) {
+		State state = createRandomState(len_states);
+		auto unbounded = stateStorage.findOrInsert(state);
+		auto bounded = boundedStateStorage.findOrInsert(state);
+		BOOST_TEST((unbounded == bounded)
+				, "Bounds should not change the index! "
+				<< unbounded.first << " ?== " << bounded.first);
+		BOOST_TEST(boundedStateStorage.get(state) == bounded.first);
+	}
+	states.clear();
+}
+
+/**
+ * Tests that a node grows through the node kinds as its fan-out increases.
+ * */
+BOOST_AUTO_TEST_CASE( nodeKindTest ) {
+	using namespace stamina::core::vectormap;
+	Trie stateStorage;
+	uint32_t key[2] = { 7, 0 };
+	for (uint32_t value = 0; value < 200; value++) {
+		key[1] = value;
+		stateStorage.findOrInsert(key, 2);
+		// A single state is one chain, the second one splits it
+		TrieNodeKind expected = value == 0 ? NODE_CHAIN
+			: value < 4 ? NODE_4
+			: value < 16 ? NODE_16
+			: value < 48 ? NODE_48
+			: NODE_256;
+		BOOST_TEST(stateStorage.getNodeCount(expected) == 1
+				, "Node with " << value + 1 << " children should be a " << nodeKindName(expected));
+	}
+	for (uint32_t value = 0; value < 200; value++) {
+		key[1] = value;
+		BOOST_TEST(stateStorage.get(key, 2) == value);
+	}
+	// Leaving the window of 256 values falls back to a sorted node
+	key[1] = 1000;
+	stateStorage.findOrInsert(key, 2);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_SORTED) == 1);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_256) == 0);
+	BOOST_TEST(stateStorage.get(key, 2) == 200);
+}
+
+BOOST_AUTO_TEST_CASE( pathCompressionTest ) {
+	using namespace stamina::core::vectormap;
+	Trie stateStorage;
+	uint32_t first[6] = { 1, 2, 3, 4, 5, 6 };
+	uint32_t second[6] = { 1, 2, 3, 9, 5, 6 };
+	uint32_t third[6] = { 1, 2, 3, 4, 5, 7 };
+	uint32_t missing[6] = { 1, 2, 3, 4, 8, 6 };
+
+	stateStorage.findOrInsert(first, 6);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_CHAIN) == 1);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_4) == 0);
+
+	// Splits into the common chain, a branch and one chain per remainder
+	stateStorage.findOrInsert(second, 6);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_CHAIN) == 3);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_4) == 1);
+
+	// Differs on the last level, so the new branch holds both indices
+	stateStorage.findOrInsert(third, 6);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_CHAIN) == 3);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_4) == 2);
+
+	BOOST_TEST(stateStorage.get(first, 6) == 0);
+	BOOST_TEST(stateStorage.get(second, 6) == 1);
+	BOOST_TEST(stateStorage.get(third, 6) == 2);
+	BOOST_TEST(!stateStorage.contains(missing, 6));
+	BOOST_TEST((stateStorage.findOrInsert(second, 6) == std::make_pair(1u, false)));
+	BOOST_TEST(stateStorage.getNumberOfStates() == 3);
+}
+
+BOOST_AUTO_TEST_CASE( burstModeTest ) {
+	using namespace stamina::core::vectormap;
+	Trie stateStorage;
+	stateStorage.setBurstMode(1, 8);
+	uint32_t key[3] = { 0, 0, 0 };
+	uint32_t expected = 0;
+	for (uint32_t first = 0; first < 2; first++) {
+		for (uint32_t second = 0; second < 4; second++) {
+			for (uint32_t third = 0; third < 3; third++) {
+				key[0] = first;
+				key[1] = second;
+				key[2] = third;
+				BOOST_TEST((stateStorage.findOrInsert(key, 3) == std::make_pair(expected++, true)));
+			}
+		}
+		// 12 suffixes do not fit into one bucket of 8, so each prefix bursts
+		// into one bucket per value of the second key
+		BOOST_TEST(stateStorage.getNodeCount(NODE_BUCKET) == 4 * (first + 1));
+	}
+	for (uint32_t index = 0; index < expected; index++) {
+		key[0] = index / 12;
+		key[1] = index / 3 % 4;
+		key[2] = index % 3;
+		BOOST_TEST(stateStorage.get(key, 3) == index);
+		BOOST_TEST((stateStorage.findOrInsert(key, 3) == std::make_pair(index, false)));
+	}
+	key[2] = 5;
+	BOOST_TEST(!stateStorage.contains(key, 3));
+}
+
+BOOST_AUTO_TEST_CASE( bitmapLastLevelTest ) {
+	using namespace stamina::core::vectormap;
+	Trie stateStorage;
+	stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 999 } }, 1024);
+	uint32_t key[2] = { 1, 0 };
+	for (uint32_t i = 0; i < 300; i++) {
+		// Insert out of order so that slots have to move
+		key[1] = (i * 7 % 300) * 3;
+		stateStorage.findOrInsert(key, 2);
+	}
+	BOOST_TEST(stateStorage.getNodeCount(NODE_BITMAP) == 1);
+	BOOST_TEST(stateStorage.getNodeCount(NODE_DENSE) == 0);
+	for (uint32_t i = 0; i < 300; i++) {
+		key[1] = (i * 7 % 300) * 3;
+		BOOST_TEST(stateStorage.get(key, 2) == i);
+		key[1] += 1;
+		BOOST_TEST(!stateStorage.contains(key, 2));
+	}
+	// Outside of the bounds, the node falls back to a sorted kind
+	key[1] = 5000;
+	BOOST_TEST((stateStorage.findOrInsert(key, 2) == std::make_pair(300u, true)));
+	BOOST_TEST(stateStorage.getNodeCount(NODE_BITMAP) == 0);
+	BOOST_TEST(stateStorage.get(key, 2) == 300);
+}
+
+template <typename KeyT>
+void checkKeySearchKernel(stamina::core::vectormap::KeySearchKernel kernel) {
+	using namespace stamina::core::vectormap;
+	KeySearchFunction<KeyT> search = keySearchFunction<KeyT>(kernel);
+	KeyT const top = (KeyT) 1 << (8 * sizeof(KeyT) - 1);
+	for (uint32_t count = 0; count <= 70; count++) {
+		// Keys with the top bit set check that the kernels compare unsigned
+		std::vector<KeyT> keys;
+		uint32_t const step = sizeof(KeyT) == 1 ? 1 : 3;
+		for (uint32_t i = 0; i < count; i++) {
+			keys.push_back(i < count / 2 ? step * i + 1 : top + step * i);
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			for (KeyT key : { (KeyT) (keys[i] - 1), keys[i], (KeyT) (keys[i] + 1) }) {
+				uint32_t expected = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+				BOOST_TEST(search(keys.data(), count, key) == expected
+						, keySearchKernelName(kernel) << " on " << 8 * sizeof(KeyT) << "-bit keys with " << count << " keys");
+			}
+		}
+		BOOST_TEST(search(keys.data(), count, (KeyT) -1) == count);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( keySearchKernelTest ) {
+	using namespace stamina::core::vectormap;
+	for (int kernel = 0; kernel < KEY_SEARCH_KERNEL_COUNT; kernel++) {
+		if (!keySearchKernelSupported((KeySearchKernel) kernel)) continue;
+		checkKeySearchKernel<uint8_t>((KeySearchKernel) kernel);
+		checkKeySearchKernel<uint16_t>((KeySearchKernel) kernel);
+		checkKeySearchKernel<uint32_t>((KeySearchKernel) kernel);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( batchTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 5;
+	const uint32_t count = 1000;
+	Trie serialStorage;
+	Trie batchStorage;
+	batchStorage.setBurstMode(2, 16);
+	std::vector<uint32_t> keys;
+	for (uint32_t batch = 0; batch < 20; batch++) {
+		keys.clear();
+		for (uint32_t i = 0; i < count * length; i++) {
+			// Few values, so that batches repeat keys of earlier batches and of themselves
+			keys.push_back(rand() % 6);
+		}
+		std::vector<std::pair<uint32_t, bool>> results(count);
+		batchStorage.findOrInsertBatch(keys.data(), length, count, results.data());
+		for (uint32_t i = 0; i < count; i++) {
+			auto expected = serialStorage.findOrInsert(keys.data() + i * length, length);
+			BOOST_TEST((results[i] == expected), "Batched key " << i << " differs");
+		}
+	}
+	std::vector<uint32_t> indices(count);
+	batchStorage.getBatch(keys.data(), length, count, indices.data());
+	for (uint32_t i = 0; i < count; i++) {
+		BOOST_TEST(indices[i] == serialStorage.get(keys.data() + i * length, length));
+	}
+	// Values the keys above never have
+	std::fill(keys.begin(), keys.end(), 9);
+	batchStorage.getBatch(keys.data(), length, count, indices.data());
+	BOOST_TEST(indices[0] == (uint32_t) -1);
+}
+
+BOOST_AUTO_TEST_CASE( keyWidthTest ) {
+	using namespace stamina::core::vectormap;
+	Trie narrowStorage;
+	Trie wideStorage;
+	// The first level is declared 8 bits wide, but gets wider keys later on
+	narrowStorage.setKeyWidths({ 8, 16 });
+	uint32_t key[2];
+	for (uint32_t i = 0; i < 4000; i++) {
+		key[0] = i < 3000 ? i % 200 : 1000 + i;
+		key[1] = i * 37 % 60000;
+		auto narrow = narrowStorage.findOrInsert(key, 2);
+		auto wide = wideStorage.findOrInsert(key, 2);
+		BOOST_TEST((narrow == wide), "Key widths should not change the index!");
+	}
+	for (uint32_t i = 0; i < 4000; i++) {
+		key[0] = i < 3000 ? i % 200 : 1000 + i;
+		key[1] = i * 37 % 60000;
+		BOOST_TEST(narrowStorage.get(key, 2) == wideStorage.get(key, 2));
+		// Does not fit into the narrow keys, so it cannot be there
+		key[1] = 70000 + i;
+		BOOST_TEST(!narrowStorage.contains(key, 2));
+	}
+}
+
+BOOST_AUTO_TEST_CASE( fixedTrieTest ) {
+	using namespace stamina::core::vectormap;
+	BOOST_TEST(!makeFixedTrie(0));
+	BOOST_TEST(!makeFixedTrie(MAX_FIXED_DEPTH + 1));
+	// (depth, key bits) pairs covering every key type
+	const uint16_t shapes[][2] = { { 1, 8 }, { 3, 8 }, { 7, 16 }, { 12, 32 }, { MAX_FIXED_DEPTH, 32 } };
+	for (auto const & shape : shapes) {
+		uint16_t const length = shape[0];
+		auto fixedStorage = makeFixedTrie(length, shape[1]);
+		BOOST_REQUIRE(fixedStorage);
+		BOOST_TEST(fixedStorage->depth() == length);
+		Trie stateStorage;
+		std::vector<uint32_t> key(length);
+		for (uint32_t i = 0; i < 3000; i++) {
+			for (auto & value : key) {
+				// Keys also get values that need all of their bits
+				if (rand() % 8 != 0) {
+					value = rand() % 5;
+				}
+				else {
+					value = shape[1] == 32 ? 0xFFFFFFF0 + rand() % 16 : rand() % (1 << shape[1]);
+				}
+			}
+			auto expected = stateStorage.findOrInsert(key.data(), length);
+			BOOST_TEST((fixedStorage->findOrInsert(key.data()) == expected), "Key " << i << " of depth " << length << " differs");
+			BOOST_TEST(fixedStorage->get(key.data()) == expected.first);
+		}
+		BOOST_TEST(fixedStorage->getNumberOfStates() == stateStorage.getNumberOfStates());
+		// Keys that may or may not be stored, found the same as by the Trie
+		std::fill(key.begin(), key.end(), 7);
+		BOOST_TEST(fixedStorage->get(key.data()) == stateStorage.get(key.data(), length));
+		key[0] = 6;
+		BOOST_TEST(fixedStorage->get(key.data()) == stateStorage.get(key.data(), length));
+		// A value too wide for the keys is not cut off into another state
+		if (shape[1] < 32) {
+			key.back() = 1 << shape[1];
+			BOOST_CHECK_THROW(fixedStorage->findOrInsert(key.data()), std::out_of_range);
+			BOOST_TEST(fixedStorage->getNumberOfStates() == stateStorage.getNumberOfStates());
+			BOOST_TEST(fixedStorage->get(key.data()) == (uint32_t) -1);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( mddTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 6;
+	uint32_t key[length];
+	// A product of independent species is one node per level
+	Trie productStorage;
+	for (uint32_t i = 0; i < 15625; i++) {
+		for (uint16_t level = 0, rest = i; level < length; level++, rest /= 5) {
+			key[level] = rest % 5;
+		}
+		productStorage.findOrInsert(key, length);
+	}
+	Mdd product(productStorage);
+	BOOST_TEST(product.getNumberOfStates() == 15625);
+	BOOST_TEST(product.getNodeCount() == length);
+
+	// Ranks follow the key order, whatever order the states were inserted in
+	Trie stateStorage;
+	stateStorage.setBurstMode(2, 16);
+	std::vector<std::vector<uint32_t>> keys;
+	for (uint32_t i = 0; i < 5000; i++) {
+		std::vector<uint32_t> k(length);
+		for (auto & value : k) {
+			value = rand() % 4 == 0 ? 1000 + rand() % 3 : rand() % 4;
+		}
+		if (stateStorage.findOrInsert(k.data(), length).second) {
+			keys.push_back(k);
+		}
+	}
+	std::vector<uint32_t> ranks;
+	Mdd mdd(stateStorage, &ranks);
+	BOOST_TEST(mdd.getNumberOfStates() == keys.size());
+	BOOST_TEST(mdd.getNodeCount() < stateStorage.getNumberOfStates());
+	auto sorted = keys;
+	std::sort(sorted.begin(), sorted.end());
+	for (uint32_t rank = 0; rank < sorted.size(); rank++) {
+		BOOST_TEST(mdd.get(sorted[rank].data(), length) == rank);
+		BOOST_TEST(ranks[stateStorage.get(sorted[rank].data(), length)] == rank);
+		mdd.stateOf(rank, key);
+		BOOST_TEST((std::vector<uint32_t>(key, key + length) == sorted[rank]));
+	}
+	std::fill(key, key + length, 7);
+	BOOST_TEST(!mdd.contains(key, length));
+	BOOST_TEST(!mdd.contains(key, length - 1));
+}
+
+BOOST_AUTO_TEST_CASE( frozenTrieTest ) {
+	using namespace stamina::core::vectormap;
+	SelectBits bits;
+	std::vector<uint64_t> zeros;
+	for (uint64_t i = 0; i < 100000; i++) {
+		bool bit = rand() % 3 != 0;
+		if (!bit) {
+			zeros.push_back(i);
+		}
+		bits.push_back(bit);
+	}
+	bits.finish();
+	for (uint64_t rank = 0; rank < zeros.size(); rank++) {
+		BOOST_REQUIRE(bits.select0(rank) == zeros[rank]);
+	}
+
+	const uint16_t length = 7;
+	Trie stateStorage;
+	stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 300 }, { 0, 3 }, { 0, 3 }, { 0, 3 }, { 0, 3 }, { 0, 40 } });
+	stateStorage.setBurstMode(4, 32);
+	std::vector<std::vector<uint32_t>> keys;
+	for (uint32_t i = 0; i < 20000; i++) {
+		std::vector<uint32_t> key(length);
+		for (uint16_t level = 0; level < length; level++) {
+			key[level] = level == 1 ? rand() % 300 : level == 6 ? rand() % 40 : rand() % 3;
+		}
+		// A few keys far outside of the bounds
+		if (i % 100 == 0) {
+			key[length - 1] = 1u << 30;
+		}
+		stateStorage.findOrInsert(key.data(), length);
+		keys.push_back(key);
+	}
+	FrozenTrie frozen = stateStorage.freeze();
+	BOOST_TEST(frozen.getNumberOfStates() == stateStorage.getNumberOfStates());
+	for (auto & key : keys) {
+		BOOST_REQUIRE(frozen.get(key.data(), length) == stateStorage.get(key.data(), length));
+		key[0] = 3;
+		BOOST_TEST(!frozen.contains(key.data(), length));
+	}
+	BOOST_TEST(!frozen.contains(keys[0].data(), length - 1));
+	BOOST_TEST(!FrozenTrie().contains(keys[0].data(), length));
+}
+
+BOOST_AUTO_TEST_CASE( fileBackedTest ) {
+	using namespace stamina::core::vectormap;
+	const std::string path = "fileBackedTest.trie";
+	const uint16_t length = 5;
+	Trie memoryStorage;
+	std::vector<std::vector<uint32_t>> keys;
+	{
+		Trie fileStorage(0, 0, new uint32_t[length] { 4, 3, 2, 1, 0 });
+		fileStorage.setSpeciesBounds({ { 0, 3 }, { 0, 3 }, { 0, 3 }, { 0, 100 }, { 0, 100 } });
+		fileStorage.setBurstMode(3, 64);
+		BOOST_REQUIRE(fileStorage.createFile(path));
+		// Enough states for the nodes to need several pool chunks
+		for (uint32_t i = 0; i < 300000; i++) {
+			std::vector<uint32_t> key(length);
+			for (auto & value : key) {
+				value = rand() % 100;
+			}
+			keys.push_back(key);
+			BOOST_TEST((fileStorage.findOrInsert(key.data(), length) == memoryStorage.findOrInsert(key.data(), length)));
+		}
+		for (uint32_t i = 0; i < 1000; i++) {
+			BOOST_TEST(fileStorage.erase(keys[i].data(), length) == memoryStorage.erase(keys[i].data(), length));
+		}
+		// The chunks have their disk blocks, so a full disk shows when the
+		// file grows and not as SIGBUS on a later write
+		struct stat status;
+		BOOST_REQUIRE(::stat(path.c_str(), &status) == 0);
+		BOOST_TEST(status.st_size >= (off_t) ((NodePool::HEADER_WORDS + 2 * NodePool::CHUNK_WORDS) * sizeof(uint32_t)));
+		BOOST_TEST((uint64_t) status.st_blocks * 512 >= (uint64_t) status.st_size);
+	}
+	Trie reopened;
+	BOOST_REQUIRE(reopened.openFile(path));
+	BOOST_TEST(reopened.getNumberOfStates() == memoryStorage.getNumberOfStates());
+	for (auto const & key : keys) {
+		BOOST_REQUIRE(reopened.get(key.data(), length) == memoryStorage.get(key.data(), length));
+	}
+	// The reopened trie keeps growing where it left off
+	for (uint32_t i = 0; i < 10000; i++) {
+		std::vector<uint32_t> key(length);
+		for (auto & value : key) {
+			value = rand() % 120;
+		}
+		BOOST_TEST((reopened.findOrInsert(key.data(), length) == memoryStorage.findOrInsert(key.data(), length)));
+	}
+	// A file cut short is rejected, and leaves the trie free to use a file
+	reopened.sync();
+	BOOST_REQUIRE(::truncate(path.c_str(), (NodePool::HEADER_WORDS + NodePool::CHUNK_WORDS) * sizeof(uint32_t)) == 0);
+	{
+		Trie damaged;
+		BOOST_TEST(!damaged.openFile(path));
+		BOOST_TEST(damaged.createFile(path + ".new"));
+	}
+	std::remove((path + ".new").c_str());
+	// Neither is a pool file that no trie was synced to, nor one whose
+	// header has sizes larger than any trie has
+	for (bool synced : { false, true }) {
+		if (synced) {
+			Trie fileStorage;
+			BOOST_REQUIRE(fileStorage.createFile(path));
+			fileStorage.findOrInsert(keys[0].data(), length);
+		}
+		{
+			NodePool pool;
+			BOOST_REQUIRE(synced ? pool.openFile(path) : pool.createFile(path));
+			pool.allocate(1);
+			if (synced) {
+				std::fill(pool.fileHeader() + 1, pool.fileHeader() + NodePool::USER_HEADER_WORDS, (uint32_t) -1);
+			}
+			pool.sync();
+		}
+		Trie damaged;
+		BOOST_TEST(!damaged.openFile(path));
+		BOOST_TEST(damaged.createFile(path + ".new"));
+		std::remove((path + ".new").c_str());
+	}
+	std::remove(path.c_str());
+	BOOST_TEST(!Trie().openFile(path));
+}
+
+BOOST_AUTO_TEST_CASE( reverseLookupTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 6;
+	State::setSliceSize(8 * sizeof(uint32_t));
+	states.clear();
+	Trie stateStorage(0, 0, new uint32_t[length] { 5, 0, 4, 1, 3, 2 });
+	stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 3 }, { 0, 3 }, { 0, 3 }, { 0, 50 }, { 0, 50 } });
+	stateStorage.setBurstMode(3, 16);
+	stateStorage.setReverseLookup(true);
+	std::vector<uint32_t> indices;
+	for (uint32_t i = 0; i < 20000; i++) {
+		auto v = createRandomVector(length, i % 2 ? 4 : 60);
+		auto inserted = stateStorage.findOrInsert(State(vecToCompressedState(v)), 0);
+		if (!inserted.second) {
+			states.pop_back();
+			continue;
+		}
+		indices.push_back(inserted.first);
+		// Check an earlier state now and then, while nodes keep moving
+		uint32_t const earlier = rand() % states.size();
+		CompressedState rebuilt(8 * sizeof(uint32_t) * length);
+		stateStorage.stateOf(indices[earlier], rebuilt);
+		BOOST_REQUIRE(rebuilt == states[earlier]);
+	}
+	// The same tables, built in one pass over a full trie
+	Trie keyStorage;
+	std::vector<std::vector<uint32_t>> keys;
+	for (uint32_t i = 0; i < 20000; i++) {
+		auto v = createRandomVector(length, 12);
+		if (keyStorage.findOrInsert(v.data(), length).second) {
+			keys.push_back(v);
+		}
+	}
+	keyStorage.setReverseLookup(true);
+	uint32_t key[MAX_KEY_LENGTH];
+	for (uint32_t index = 0; index < keys.size(); index++) {
+		BOOST_REQUIRE(keyStorage.stateOf(index, key) == length);
+		BOOST_REQUIRE((std::vector<uint32_t>(key, key + length) == keys[index]));
+	}
+	for (uint32_t index = 0; index < states.size(); index++) {
+		CompressedState rebuilt(8 * sizeof(uint32_t) * length);
+		stateStorage.stateOf(indices[index], rebuilt);
+		BOOST_REQUIRE(rebuilt == states[index]);
+	}
+	states.clear();
+}
+
+BOOST_AUTO_TEST_CASE( pinnedLookupTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 8;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie pinnedStorage;
+		Trie plainStorage;
+		pinnedStorage.setSpeciesBounds(std::vector<std::pair<uint32_t, uint32_t>>(length, { 0, 20 }));
+		pinnedStorage.setBurstMode(4, burstThreshold);
+		std::vector<std::vector<uint32_t>> queue(1, std::vector<uint32_t>(length, 10));
+		pinnedStorage.findOrInsert(queue[0].data(), length);
+		plainStorage.findOrInsert(queue[0].data(), length);
+		// Expand states like reactions would, changing two species by one
+		for (std::size_t next = 0; next < queue.size() && queue.size() < 20000; next++) {
+			std::vector<uint32_t> state = queue[next];
+			pinnedStorage.pin(state.data(), length);
+			for (uint16_t reaction = 0; reaction < length; reaction++) {
+				std::vector<uint32_t> successor = state;
+				uint16_t const other = (reaction + 1 + rand() % (length - 1)) % length;
+				if (successor[reaction] == 0 || successor[other] == 20) {
+					continue;
+				}
+				successor[reaction]--;
+				successor[other]++;
+				auto result = pinnedStorage.findOrInsertPinned(successor.data(), length);
+				BOOST_REQUIRE((result == plainStorage.findOrInsert(successor.data(), length)));
+				if (result.second) {
+					queue.push_back(successor);
+				}
+			}
+			// Insertions outside of the pinned path unpin it
+			if (next % 100 == 0) {
+				std::vector<uint32_t> other = createRandomVector(length, 21);
+				BOOST_REQUIRE((pinnedStorage.findOrInsert(other.data(), length) == plainStorage.findOrInsert(other.data(), length)));
+			}
+		}
+		for (auto const & state : queue) {
+			BOOST_REQUIRE(pinnedStorage.get(state.data(), length) == plainStorage.get(state.data(), length));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE( eraseTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 5;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie stateStorage;
+		stateStorage.setSpeciesBounds({ { 0, 40 }, { 0, 40 }, { 0, 3 }, { 0, 40 }, { 0, 40 } });
+		stateStorage.setBurstMode(2, burstThreshold);
+		stateStorage.setReverseLookup(true);
+		std::map<std::vector<uint32_t>, uint32_t> stored;
+		for (uint32_t i = 0; i < 30000; i++) {
+			auto v = createRandomVector(length, i % 3 == 0 ? 4 : i % 3 == 1 ? 41 : 400);
+			auto inserted = stateStorage.findOrInsert(v.data(), length);
+			if (inserted.second) {
+				stored[v] = inserted.first;
+			}
+		}
+		std::size_t const fullBytes = stateStorage.bytesInUse();
+
+		// Erase every other state
+		std::vector<std::vector<uint32_t>> erased;
+		bool odd = false;
+		for (auto it = stored.begin(); it != stored.end(); ) {
+			if ((odd = !odd)) {
+				BOOST_REQUIRE(stateStorage.erase(it->first.data(), length));
+				BOOST_REQUIRE(!stateStorage.erase(it->first.data(), length));
+				erased.push_back(it->first);
+				it = stored.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		BOOST_TEST(stateStorage.getNumberOfStates() == stored.size());
+		BOOST_TEST(stateStorage.bytesInUse() < fullBytes);
+		for (auto const & key : erased) {
+			BOOST_REQUIRE(!stateStorage.contains(key.data(), length));
+		}
+		uint32_t key[MAX_KEY_LENGTH];
+		for (auto const & entry : stored) {
+			BOOST_REQUIRE(stateStorage.get(entry.first.data(), length) == entry.second);
+			stateStorage.stateOf(entry.second, key);
+			BOOST_REQUIRE((std::vector<uint32_t>(key, key + length) == entry.first));
+		}
+
+		// Erased states come back with the indices of erased states
+		stateStorage.setIndexRecycling(true);
+		uint32_t const limit = stateStorage.getIndexLimit();
+		for (std::size_t i = 0; i < erased.size(); i += 2) {
+			auto inserted = stateStorage.findOrInsert(erased[i].data(), length);
+			BOOST_REQUIRE(inserted.second);
+			BOOST_REQUIRE(inserted.first < limit);
+			stored[erased[i]] = inserted.first;
+		}
+		BOOST_TEST(stateStorage.getIndexLimit() == limit);
+
+		auto newIndices = stateStorage.renumber();
+		BOOST_TEST(stateStorage.getIndexLimit() == stored.size());
+		for (auto const & entry : stored) {
+			uint32_t const index = stateStorage.get(entry.first.data(), length);
+			BOOST_REQUIRE(index == newIndices[entry.second]);
+			BOOST_REQUIRE(index < stored.size());
+			stateStorage.stateOf(index, key);
+			BOOST_REQUIRE((std::vector<uint32_t>(key, key + length) == entry.first));
+		}
+
+		// Nothing is left once every state is erased
+		for (auto const & entry : stored) {
+			BOOST_REQUIRE(stateStorage.erase(entry.first.data(), length));
+		}
+		BOOST_TEST(stateStorage.getNumberOfStates() == 0);
+		BOOST_TEST(stateStorage.bytesInUse() == 0);
+		for (uint32_t kind = 0; kind < NODE_KIND_COUNT; kind++) {
+			BOOST_TEST(stateStorage.getNodeCount((TrieNodeKind) kind) == 0);
+		}
+		BOOST_TEST(stateStorage.findOrInsert(erased[0].data(), length).second);
+	}
+
+	// Children taken out of the middle of bitmap and indexed nodes. Only
+	// keys that are close together fit an indexed node.
+	Trie bitmapStorage;
+	bitmapStorage.setSpeciesBounds({ { 0, 999 } }, 1024);
+	Trie indexedStorage;
+	for (auto storage : { std::make_pair(&bitmapStorage, 20u), std::make_pair(&indexedStorage, 3u) }) {
+		uint32_t key[1];
+		for (uint32_t i = 0; i < 40; i++) {
+			key[0] = 100 + i * 7 % 40 * storage.second;
+			storage.first->findOrInsert(key, 1);
+		}
+		for (uint32_t i = 0; i < 40; i += 2) {
+			key[0] = 100 + i * 7 % 40 * storage.second;
+			BOOST_REQUIRE(storage.first->erase(key, 1));
+		}
+		for (uint32_t i = 0; i < 40; i++) {
+			key[0] = 100 + i * 7 % 40 * storage.second;
+			BOOST_REQUIRE(storage.first->get(key, 1) == (i % 2 ? i : (uint32_t) -1));
+		}
+	}
+	BOOST_TEST(bitmapStorage.getNodeCount(NODE_BITMAP) == 1);
+	BOOST_TEST(indexedStorage.getNodeCount(NODE_48) == 1);
+}
+
+BOOST_AUTO_TEST_CASE( rangeQueryTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 5;
+	State::setSliceSize(8 * sizeof(uint32_t));
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie stateStorage(0, 0, new uint32_t[length] { 2, 0, 4, 1, 3 });
+		stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 20 }, { 0, 3 }, { 0, 20 }, { 0, 600 } }, 1024);
+		stateStorage.setBurstMode(2, burstThreshold);
+		std::vector<std::vector<uint32_t>> stored;
+		for (uint32_t i = 0; i < 20000; i++) {
+			std::vector<uint32_t> state = createRandomVector(length, i % 2 ? 4 : 21);
+			state[4] = rand() % (i % 3 ? 600 : 60);
+			uint32_t key[MAX_KEY_LENGTH];
+			stateStorage.decode(State(vecToCompressedState(state)), 0, key);
+			if (stateStorage.findOrInsert(key, length).second) {
+				stored.push_back(state);
+			}
+		}
+		for (uint32_t query = 0; query < 200; query++) {
+			// Some species bounded on one side, some on both, some not at all
+			std::vector<std::pair<uint32_t, uint32_t>> ranges(length - query % 2, { 0, (uint32_t) -1 });
+			for (auto & range : ranges) {
+				if (rand() % 2) {
+					range.first = rand() % 10;
+				}
+				if (rand() % 2) {
+					range.second = range.first + rand() % (query % 4 == 0 ? 300 : 12);
+				}
+			}
+			std::set<uint32_t> expected;
+			for (uint32_t index = 0; index < stored.size(); index++) {
+				bool inRange = true;
+				for (std::size_t species = 0; species < ranges.size(); species++) {
+					inRange &= stored[index][species] >= ranges[species].first && stored[index][species] <= ranges[species].second;
+				}
+				if (inRange) {
+					expected.insert(index);
+				}
+			}
+			std::vector<uint32_t> found;
+			std::vector<uint32_t> previous;
+			stateStorage.forEachStateInRange(ranges, [&](const uint32_t * key, uint16_t keyLength, uint32_t index) {
+				BOOST_REQUIRE(keyLength == length);
+				BOOST_REQUIRE(stateStorage.get(key, keyLength) == index);
+				// Keys come in increasing order, like in forEachState()
+				BOOST_REQUIRE(std::lexicographical_compare(previous.begin(), previous.end(), key, key + keyLength));
+				previous.assign(key, key + keyLength);
+				found.push_back(index);
+			});
+			BOOST_REQUIRE((std::set<uint32_t>(found.begin(), found.end()) == expected));
+			BOOST_REQUIRE(found.size() == expected.size());
+			BOOST_REQUIRE(stateStorage.countStatesInRange(ranges) == expected.size());
+		}
+	}
+	states.clear();
+}
+
+BOOST_AUTO_TEST_CASE( statsTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 5;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie stateStorage;
+		stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 3 }, { 0, 40 }, { 0, 40 }, { 0, 40 } });
+		stateStorage.setBurstMode(3, burstThreshold);
+		for (uint32_t i = 0; i < 20000; i++) {
+			auto v = createRandomVector(length, i % 2 ? 4 : 41);
+			stateStorage.findOrInsert(v.data(), length);
+		}
+		TrieStats stats = stateStorage.stats();
+		BOOST_TEST(stats.states == stateStorage.getNumberOfStates());
+		BOOST_TEST(stats.bytesInUse == stateStorage.bytesInUse());
+		BOOST_REQUIRE(stats.levels.size() == length);
+		uint64_t bytes = 0;
+		for (uint32_t kind = 0; kind < NODE_KIND_COUNT; kind++) {
+			BOOST_TEST(stats.nodes[kind] == stateStorage.getNodeCount((TrieNodeKind) kind));
+			uint64_t levelNodes = 0;
+			for (auto const & level : stats.levels) {
+				levelNodes += level.nodes[kind];
+			}
+			BOOST_TEST(levelNodes == stats.nodes[kind]);
+			bytes += stats.bytes[kind];
+		}
+		BOOST_TEST(bytes == stats.bytesInUse);
+		// Every state is a child of a last level node, an entry of a bucket,
+		// or at the end of a chain that reaches the last level
+		uint64_t leaves = 0;
+		for (auto const & children : stats.levels[length - 1].fanOut) {
+			leaves += (uint64_t) children.first * children.second;
+		}
+		for (auto const & buckets : stats.bucketSizes) {
+			leaves += (uint64_t) buckets.first * buckets.second;
+		}
+		uint64_t chains = 0;
+		for (auto const & lengths : stats.chainLengths) {
+			chains += lengths.second;
+		}
+		BOOST_TEST(chains == stats.nodes[NODE_CHAIN]);
+		BOOST_TEST(leaves <= stats.states);
+		BOOST_TEST(leaves + chains >= stats.states);
+
+		std::ostringstream out;
+		stats.print(out);
+		BOOST_TEST(out.str().find("states\t" + std::to_string(stats.states) + "\n") == 0);
+		BOOST_TEST(out.str().find("kind\tNODE_CHAIN\t") != std::string::npos);
+		BOOST_TEST((out.str().find("bucket\t") != std::string::npos) == (burstThreshold != 0));
+	}
+}
+
+BOOST_AUTO_TEST_CASE( compactTest ) {
+	using namespace stamina::core::vectormap;
+	const std::string path = "compactTest.trie";
+	const uint16_t length = 6;
+	std::vector<std::vector<uint32_t>> keys;
+	for (uint32_t i = 0; i < 40000; i++) {
+		keys.push_back(createRandomVector(length, i % 2 ? 4 : 30));
+	}
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie plainStorage;
+		plainStorage.setSpeciesBounds(std::vector<std::pair<uint32_t, uint32_t>>(length, { 0, 29 }));
+		plainStorage.setBurstMode(3, burstThreshold);
+		{
+			Trie stateStorage;
+			stateStorage.setSpeciesBounds(std::vector<std::pair<uint32_t, uint32_t>>(length, { 0, 29 }));
+			stateStorage.setBurstMode(3, burstThreshold);
+			BOOST_REQUIRE(stateStorage.createFile(path));
+			stateStorage.setReverseLookup(true);
+			stateStorage.setAutoCompaction(3000);
+			for (std::size_t i = 0; i < keys.size() / 2; i++) {
+				BOOST_REQUIRE((stateStorage.findOrInsert(keys[i].data(), length) == plainStorage.findOrInsert(keys[i].data(), length)));
+			}
+			std::size_t const bytes = stateStorage.bytesInUse();
+			BOOST_REQUIRE(stateStorage.compact(0));
+			BOOST_TEST(stateStorage.bytesInUse() == bytes);
+			BOOST_REQUIRE(stateStorage.compact());
+			// Lookups, insertions and the reverse lookup all go on as before
+			uint32_t key[MAX_KEY_LENGTH];
+			for (std::size_t i = 0; i < keys.size(); i++) {
+				auto result = stateStorage.findOrInsert(keys[i].data(), length);
+				BOOST_REQUIRE((result == plainStorage.findOrInsert(keys[i].data(), length)));
+				stateStorage.stateOf(result.first, key);
+				BOOST_REQUIRE((std::vector<uint32_t>(key, key + length) == keys[i]));
+			}
+			for (uint32_t kind = 0; kind < NODE_KIND_COUNT; kind++) {
+				BOOST_TEST(stateStorage.getNodeCount((TrieNodeKind) kind) == plainStorage.getNodeCount((TrieNodeKind) kind));
+			}
+		}
+		// The compacted file replaced the old one
+		Trie reopened;
+		BOOST_REQUIRE(reopened.openFile(path));
+		for (auto const & key : keys) {
+			BOOST_REQUIRE(reopened.get(key.data(), length) == plainStorage.get(key.data(), length));
+		}
+	}
+	std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( cursorTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 4;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie stateStorage;
+		stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 40 }, { 0, 999 }, { 0, 999 } }, 1024);
+		stateStorage.setBurstMode(2, burstThreshold);
+		std::map<std::vector<uint32_t>, uint32_t> stored;
+		for (uint32_t i = 0; i < 20000; i++) {
+			std::vector<uint32_t> key = createRandomVector(length, i % 2 ? 4 : 41);
+			key[2] = rand() % (i % 3 ? 1000 : 60);
+			key[3] = 100 + rand() % (i % 5 ? 40 : 900);
+			auto inserted = stateStorage.findOrInsert(key.data(), length);
+			if (inserted.second) {
+				stored[key] = inserted.first;
+			}
+		}
+		// Gaps left by erased states are skipped
+		for (auto it = stored.begin(); it != stored.end(); ) {
+			if (rand() % 4 == 0) {
+				stateStorage.erase(it->first.data(), length);
+				it = stored.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+
+		Trie::Cursor cursor(stateStorage);
+		for (auto const & entry : stored) {
+			BOOST_REQUIRE(cursor.valid());
+			BOOST_REQUIRE((std::vector<uint32_t>(cursor.key(), cursor.key() + cursor.length()) == entry.first));
+			BOOST_REQUIRE(cursor.index() == entry.second);
+			cursor.next();
+		}
+		BOOST_TEST(!cursor.valid());
+
+		for (uint32_t i = 0; i < 5000; i++) {
+			std::vector<uint32_t> prefix = { (uint32_t) (rand() % 5), (uint32_t) (rand() % 45), (uint32_t) (rand() % 1010), (uint32_t) (100 + rand() % 910) };
+			if (i % 2) {
+				// Prefixes of stored keys, so that the seek ends on them
+				prefix = std::next(stored.begin(), rand() % stored.size())->first;
+			}
+			uint16_t const prefixLength = rand() % (length + 1);
+			prefix.resize(prefixLength);
+			// The first stored key not less than the prefix
+			auto expected = stored.lower_bound(prefix);
+			BOOST_REQUIRE(cursor.seek(prefix.data(), prefixLength) == (expected != stored.end()));
+			if (expected == stored.end()) {
+				continue;
+			}
+			BOOST_REQUIRE((std::vector<uint32_t>(cursor.key(), cursor.key() + length) == expected->first));
+			BOOST_REQUIRE(cursor.index() == expected->second);
+			// And the cursor goes on from there
+			for (uint32_t step = 0; step < 3 && ++expected != stored.end(); step++) {
+				cursor.next();
+				BOOST_REQUIRE(cursor.valid());
+				BOOST_REQUIRE(cursor.index() == expected->second);
+			}
+		}
+	}
+	BOOST_TEST(!Trie::Cursor(Trie()).valid());
+
+	// Keys far apart on a bounded last level go into a bitmap
+	Trie bitmapStorage;
+	bitmapStorage.setSpeciesBounds({ { 0, 999 } }, 1024);
+	uint32_t key[1];
+	for (uint32_t i = 0; i < 40; i++) {
+		key[0] = i * 7 % 40 * 20;
+		bitmapStorage.findOrInsert(key, 1);
+	}
+	BOOST_REQUIRE(bitmapStorage.getNodeCount(NODE_BITMAP) == 1);
+	key[0] = 101;
+	Trie::Cursor cursor(bitmapStorage);
+	BOOST_REQUIRE(cursor.seek(key, 1));
+	for (uint32_t value = 120; value < 800; value += 20) {
+		BOOST_REQUIRE(cursor.valid());
+		BOOST_REQUIRE(cursor.key()[0] == value);
+		cursor.next();
+	}
+	BOOST_TEST(!cursor.valid());
+}
+
+BOOST_AUTO_TEST_CASE( setOperationsTest ) {
+	const uint16_t length = 5;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		// Different layouts on both sides: bounds and burst mode only on one
+		// trie, and the other one mostly chains from its sparse keys
+		Trie own;
+		own.setSpeciesBounds({ { 0, 3 }, { 0, 3 }, { 0, 40 }, { 0, 40 }, { 0, 40 } });
+		own.setBurstMode(2, burstThreshold);
+		Trie other;
+		std::set<std::vector<uint32_t>> ownKeys;
+		std::set<std::vector<uint32_t>> otherKeys;
+		for (uint32_t i = 0; i < 20000; i++) {
+			auto v = createRandomVector(length, i % 2 ? 4 : 41);
+			if (i % 3 != 0) {
+				own.findOrInsert(v.data(), length);
+				ownKeys.insert(v);
+			}
+			if (i % 3 != 1) {
+				other.findOrInsert(v.data(), length);
+				otherKeys.insert(v);
+			}
+		}
+		// Some erased states leave paths that end nowhere in one of the tries
+		for (uint32_t i = 0; i < 500; i++) {
+			auto v = createRandomVector(length, 4);
+			if (own.erase(v.data(), length)) {
+				ownKeys.erase(v);
+			}
+		}
+		auto const contents = [](const Trie & trie) {
+			std::vector<std::vector<uint32_t>> keys;
+			trie.forEachState([&](const uint32_t * key, uint16_t keyLength, uint32_t) {
+				keys.emplace_back(key, key + keyLength);
+			});
+			return keys;
+		};
+		std::vector<std::vector<uint32_t>> expected;
+		Trie united;
+		own.unite(other, united);
+		std::set_union(ownKeys.begin(), ownKeys.end(), otherKeys.begin(), otherKeys.end(), std::back_inserter(expected));
+		BOOST_REQUIRE(contents(united) == expected);
+		BOOST_TEST(own.countUnion(other) == expected.size());
+		expected.clear();
+		Trie intersected;
+		intersected.setBurstMode(3, 8);
+		own.intersect(other, intersected);
+		std::set_intersection(ownKeys.begin(), ownKeys.end(), otherKeys.begin(), otherKeys.end(), std::back_inserter(expected));
+		BOOST_REQUIRE(contents(intersected) == expected);
+		BOOST_TEST(own.countIntersection(other) == expected.size());
+		BOOST_TEST(other.countIntersection(own) == expected.size());
+		expected.clear();
+		Trie subtracted;
+		other.subtract(own, subtracted);
+		std::set_difference(otherKeys.begin(), otherKeys.end(), ownKeys.begin(), ownKeys.end(), std::back_inserter(expected));
+		BOOST_REQUIRE(contents(subtracted) == expected);
+		BOOST_TEST(other.countDifference(own) == expected.size());
+		// The result trie hands out indices in key order
+		uint32_t next = 0;
+		subtracted.forEachState([&](const uint32_t *, uint16_t, uint32_t index) {
+			BOOST_REQUIRE(index == next++);
+		});
+		// Shared states come with the index of the first trie
+		own.merge(other, true, false, false, [&](const uint32_t * key, uint16_t keyLength, uint32_t index) {
+			BOOST_REQUIRE(own.get(key, keyLength) == index);
+		});
+		// An empty trie on either side
+		Trie empty;
+		BOOST_TEST(empty.countIntersection(own) == 0);
+		BOOST_TEST(own.countDifference(empty) == ownKeys.size());
+		Trie copied;
+		empty.unite(own, copied);
+		BOOST_TEST(copied.getNumberOfStates() == ownKeys.size());
+		// A trie with itself, and with a twin of the same layout with a few
+		// more states, so that whole nodes are equal on both sides
+		BOOST_TEST(own.countIntersection(own) == ownKeys.size());
+		Trie none;
+		own.subtract(own, none);
+		BOOST_TEST(none.getNumberOfStates() == 0);
+		Trie twin;
+		for (const auto & key : otherKeys) {
+			twin.findOrInsert(key.data(), length);
+		}
+		std::set<std::vector<uint32_t>> twinKeys = otherKeys;
+		for (uint32_t i = 0; i < 50; i++) {
+			auto v = createRandomVector(length, 41);
+			twin.findOrInsert(v.data(), length);
+			twinKeys.insert(v);
+		}
+		BOOST_TEST(twin.countIntersection(other) == otherKeys.size());
+		BOOST_TEST(other.countIntersection(twin) == otherKeys.size());
+		expected.clear();
+		Trie added;
+		twin.subtract(other, added);
+		std::set_difference(twinKeys.begin(), twinKeys.end(), otherKeys.begin(), otherKeys.end(), std::back_inserter(expected));
+		BOOST_REQUIRE(contents(added) == expected);
+		uint32_t shared = 0;
+		twin.merge(other, true, false, false, [&](const uint32_t * key, uint16_t keyLength, uint32_t index) {
+			BOOST_REQUIRE(twin.get(key, keyLength) == index);
+			++shared;
+		});
+		BOOST_TEST(shared == otherKeys.size());
+		Trie ownTwin;
+		ownTwin.setSpeciesBounds({ { 0, 3 }, { 0, 3 }, { 0, 40 }, { 0, 40 }, { 0, 40 } });
+		ownTwin.setBurstMode(2, burstThreshold);
+		for (const auto & key : ownKeys) {
+			ownTwin.findOrInsert(key.data(), length);
+		}
+		BOOST_TEST(own.countIntersection(ownTwin) == ownKeys.size());
+		BOOST_TEST(own.countDifference(ownTwin) == 0);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( histogramTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 4;
+	for (uint32_t burstThreshold : { 0, 16 }) {
+		Trie stateStorage(0, 0, new uint32_t[length] { 2, 0, 3, 1 });
+		stateStorage.setSpeciesBounds({ { 0, 3 }, { 0, 40 }, { 0, 3 }, { 0, 40 } });
+		stateStorage.setBurstMode(1, burstThreshold);
+		std::set<std::vector<uint32_t>> stored;
+		for (uint32_t i = 0; i < 20000; i++) {
+			auto v = createRandomVector(length, i % 2 ? 4 : 41);
+			v[0] %= 4;
+			v[2] %= 4;
+			// The key has the ordering applied, the histograms undo it
+			uint32_t key[length] = { v[2], v[0], v[3], v[1] };
+			stateStorage.findOrInsert(key, length);
+			stored.insert(v);
+		}
+		TrieHistograms histograms = stateStorage.histograms(true);
+		BOOST_TEST(histograms.states == stored.size());
+		std::vector<std::map<uint32_t, uint64_t>> values(length);
+		std::map<std::pair<uint32_t, uint32_t>, std::map<std::pair<uint32_t, uint32_t>, uint64_t>> joint;
+		for (auto const & v : stored) {
+			for (uint32_t species = 0; species < length; species++) {
+				++values[species][v[species]];
+				for (uint32_t other = species + 1; other < length; other++) {
+					++joint[{ species, other }][{ v[species], v[other] }];
+				}
+			}
+		}
+		BOOST_REQUIRE(histograms.values == values);
+		BOOST_REQUIRE(histograms.joint == joint);
+		BOOST_TEST(stateStorage.histograms().joint.empty());
+		auto bounds = histograms.bounds();
+		BOOST_TEST(bounds[0].second == 3);
+		BOOST_TEST(bounds[1].second == 40);
+		auto ordering = histograms.orderingByDistinctValues();
+		BOOST_TEST(ordering[0] == 0);
+		BOOST_TEST(ordering[1] == 2);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( valueTrieTest ) {
+	using namespace stamina::core::vectormap;
+	const uint16_t length = 5;
+	// Reachability, frontier flag and exit rate per state
+	ValueTrie<double, bool, float> stateStorage;
+	stateStorage.setIndexRecycling(true);
+	stateStorage.setBurstMode(2, 16);
+	std::map<std::vector<uint32_t>, double> expected;
+	auto v = createRandomVector(length, 41);
+	auto firstPayload = stateStorage.payloadOf(v.data(), length);
+	double & first = std::get<0>(firstPayload);
+	first = 0.5;
+	std::get<2>(firstPayload) = (float) v[0];
+	// More states than fit in one chunk, so that the columns grow
+	for (uint32_t i = 0; i < 3 * PayloadColumn<double>::CHUNK_SIZE; i++) {
+		auto w = createRandomVector(length, 41);
+		auto payload = stateStorage.payloadOf(w.data(), length);
+		std::get<0>(payload) += 0.25;
+		std::get<1>(payload) = true;
+		std::get<2>(payload) = (float) w[0];
+		expected[w] += 0.25;
+	}
+	expected[v] += 0.5;
+	// Growing never moved the first payload
+	BOOST_TEST(first == expected[v]);
+	BOOST_REQUIRE(stateStorage.column<0>().size() == stateStorage.getTrie().getIndexLimit());
+	for (auto const & stateAndReachability : expected) {
+		uint32_t index = stateStorage.getTrie().get(stateAndReachability.first.data(), length);
+		BOOST_REQUIRE(std::get<0>(stateStorage.payload(index)) == stateAndReachability.second);
+	}
+	// A new state that takes the index of an erased one starts out empty
+	auto erased = expected.begin()->first;
+	uint32_t erasedIndex = stateStorage.getTrie().get(erased.data(), length);
+	BOOST_REQUIRE(stateStorage.erase(erased.data(), length));
+	expected.erase(erased);
+	std::vector<uint32_t> fresh(length, 100);
+	auto indexAndInserted = stateStorage.findOrInsert(fresh.data(), length);
+	BOOST_REQUIRE(indexAndInserted.second);
+	BOOST_TEST(indexAndInserted.first == erasedIndex);
+	BOOST_TEST(std::get<0>(stateStorage.payload(erasedIndex)) == 0.0);
+	BOOST_TEST(!std::get<1>(stateStorage.payload(erasedIndex)));
+	BOOST_REQUIRE(stateStorage.erase(fresh.data(), length));
+	// Payloads move along with their states when they are renumbered
+	for (uint32_t i = 0; i < 1000; i++) {
+		auto w = createRandomVector(length, 41);
+		if (stateStorage.erase(w.data(), length)) {
+			expected.erase(w);
+		}
+	}
+	stateStorage.renumber();
+	BOOST_REQUIRE(stateStorage.getTrie().getIndexLimit() == expected.size());
+	for (auto const & stateAndReachability : expected) {
+		uint32_t index = stateStorage.getTrie().get(stateAndReachability.first.data(), length);
+		auto payload = stateStorage.payload(index);
+		BOOST_REQUIRE(std::get<0>(payload) == stateAndReachability.second);
+		BOOST_REQUIRE(std::get<2>(payload) == (float) stateAndReachability.first[0]);
+	}
+	BOOST_TEST(stateStorage.bytesInUse() > stateStorage.getTrie().bytesInUse());
+}
+
+BOOST_AUTO_TEST_CASE( fileFullTest ) {
+	using namespace stamina::core::vectormap;
+	const std::string path = "fileFullTest.trie";
+	const uint16_t length = 5;
+	// Files may only grow to the header and four chunks, like a full disk
+	std::size_t const limitBytes = (NodePool::HEADER_WORDS + 4 * NodePool::CHUNK_WORDS) * sizeof(uint32_t);
+	struct rlimit oldLimit;
+	BOOST_REQUIRE(::getrlimit(RLIMIT_FSIZE, &oldLimit) == 0);
+	struct rlimit limit = oldLimit;
+	limit.rlim_cur = limitBytes;
+	auto const oldHandler = std::signal(SIGXFSZ, SIG_IGN);
+	BOOST_REQUIRE(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+	{
+		Trie fileStorage;
+		BOOST_REQUIRE(fileStorage.createFile(path));
+		std::vector<std::vector<uint32_t>> keys;
+		bool full = false;
+		while (!full) {
+			std::vector<uint32_t> key(length);
+			for (auto & value : key) {
+				value = rand() % 100;
+			}
+			try {
+				if (fileStorage.findOrInsert(key.data(), length).second) {
+					keys.push_back(key);
+				}
+			}
+			catch (const std::runtime_error &) {
+				full = true;
+			}
+		}
+		// The states stored before are still there. The one being inserted
+		// when the pool ran out may be left half inserted.
+		for (std::size_t i = 0; i < keys.size(); i += 97) {
+			BOOST_REQUIRE(fileStorage.get(keys[i].data(), length) == i);
+		}
+		// With even less room, the compacted copy does not fit, so the trie
+		// is left as it was
+		limit.rlim_cur = (NodePool::HEADER_WORDS + NodePool::CHUNK_WORDS) * sizeof(uint32_t);
+		BOOST_REQUIRE(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+		BOOST_TEST(!fileStorage.compact());
+		for (std::size_t i = 0; i < keys.size(); i += 97) {
+			BOOST_REQUIRE(fileStorage.get(keys[i].data(), length) == i);
+		}
+	}
+	BOOST_REQUIRE(::setrlimit(RLIMIT_FSIZE, &oldLimit) == 0);
+	std::signal(SIGXFSZ, oldHandler);
+	std::remove(path.c_str());
+	std::remove((path + ".compact").c_str());
+	// The compacted file cannot replace a directory, so compaction fails
+	// and leaves the trie as it was
+	{
+		Trie fileStorage;
+		BOOST_REQUIRE(fileStorage.createFile(path));
+		for (uint32_t i = 0; i < 1000; i++) {
+			fileStorage.findOrInsert(createRandomVector(length, 41).data(), length);
+		}
+		uint32_t const states = fileStorage.getNumberOfStates();
+		std::remove(path.c_str());
+		BOOST_REQUIRE(::mkdir(path.c_str(), 0755) == 0);
+		BOOST_TEST(!fileStorage.compact());
+		BOOST_TEST(fileStorage.getNumberOfStates() == states);
+		fileStorage.forEachState([&](const uint32_t * key, uint16_t keyLength, uint32_t index) {
+			BOOST_REQUIRE(fileStorage.get(key, keyLength) == index);
+		});
+		BOOST_TEST(!std::ifstream(path + ".compact").good());
+	}
+	::rmdir(path.c_str());
+}
@@ -4,6 +4,9 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <map>
+#include <string>
+#include <utility>
 
 #include "IndexableBitVector.h"
 
@@ -80,6 +83,53 @@ public:
 	std::string filename;
 	std::string propFileName;
 	int maxNumToExplore;
+	// Optional (lowest, highest) count of each species, e.g. from bounding/bounds.py.
+	// Used instead of the ranges declared in the model.
+	std::map<std::string, std::pair<uint32_t, uint32_t>> speciesBounds;
+	// Widest species range that gets directly indexed trie nodes
+	uint32_t maxDenseSpan;
+	// Burst mode of the trie: the number of species that are always trie
+	// levels, and how many states the bucket below them holds before it
+	// bursts. A threshold of 0 turns burst mode off.
+	uint16_t burstLevels;
+	uint32_t burstThreshold;
+	// Resolve the successors of each expanded state with one batched trie
+	// lookup instead of one lookup per successor
+	bool batchLookups;
+	// Store the states in the FixedTrie instantiated for the number of
+	// species of the model instead of in the adaptive Trie
+	bool useFixedTrie;
+	// After exploration, also build the Mdd of the explored states and
+	// report its size
+	bool buildDiagram;
+	// After exploration, freeze the trie into a FrozenTrie and report its size
+	bool freezeTrie;
+	// If not empty, the trie keeps its nodes in this file, which can be
+	// reopened with Trie::openFile() after exploration
+	std::string trieFile;
+	// Keep only state indices in the exploration queue and rebuild each
+	// state from the trie when it is expanded (see Trie::stateOf())
+	bool queueIndices;
+	// Pin the trie path of each expanded state and start the lookups of its
+	// successors from where their keys leave it (see Trie::pin())
+	bool pinnedLookups;
+	// Optional (lowest, highest) count of species that a target state has,
+	// e.g. (50, max) of S5 for S5 >= 50. After exploration, the states in
+	// all of the ranges are counted with a range query on the trie.
+	std::map<std::string, std::pair<uint32_t, uint32_t>> targetRanges;
+	// If not 0, print Trie::stats() every time this many more states have
+	// been explored
+	uint32_t statsInterval;
+	// If not 0, compact the trie every time this many states were added
+	// (see Trie::compact()). With compactTrie it is also compacted once
+	// exploration is done.
+	uint32_t compactInterval;
+	bool compactTrie;
+	// After exploration, print the histogram of each species' values over
+	// the explored states (see Trie::histograms()), with jointHistograms
+	// also the counts of each pair of values of two species
+	bool printHistograms;
+	bool jointHistograms;
 
 	Settings(
 		std::vector<std::string> & ordering
@@ -91,9 +141,26 @@ public:
 		, filename(filename)
 		, propFileName(propFileName)
 		, maxNumToExplore(maxNumToExplore)
+		, maxDenseSpan(256)
+		, burstLevels(0)
+		, burstThreshold(0)
+		, batchLookups(false)
+		, useFixedTrie(false)
+		, buildDiagram(false)
+		, freezeTrie(false)
+		, queueIndices(false)
+		, pinnedLookups(false)
+		, statsInterval(0)
+		, compactInterval(0)
+		, compactTrie(false)
+		, printHistograms(false)
+		, jointHistograms(false)
 	{ /* Intentionally left empty */}
 
 	uint32_t * orderingToArray() {
+		if (this->ordering.empty()) {
+			return nullptr;
+		}
 		uint32_t * orderArray = new uint32_t[ordering.size()];
 		for (size_t i = 0; i < this->ordering.size(); ++i) {
 			std::string species = this->ordering[i];
@@ -103,6 +170,37 @@ public:
 		}
 		return orderArray;
 	}
+
+	/**
+	 * Gets the range of each species in the order they are stored, using
+	 * `speciesBounds` where given and the model's declared ranges otherwise.
+	 * */
+	std::vector<std::pair<uint32_t, uint32_t>> boundsToVector() {
+		auto bounds = stamina::core::vectormap::IndexableBitVector<uint32_t>::speciesBounds();
+		for (auto const & speciesAndBounds : this->speciesBounds) {
+			auto idx = stamina::core::vectormap::IndexableBitVector<uint32_t>::indexFromString(speciesAndBounds.first);
+			if (idx >= 0) {
+				bounds[idx] = speciesAndBounds.second;
+			}
+		}
+		return bounds;
+	}
+
+	/**
+	 * Gets the range of each species in the order they are stored, using
+	 * `targetRanges` where given and any value otherwise.
+	 * */
+	std::vector<std::pair<uint32_t, uint32_t>> targetRangesToVector() {
+		auto ranges = stamina::core::vectormap::IndexableBitVector<uint32_t>::speciesBounds();
+		std::fill(ranges.begin(), ranges.end(), std::make_pair(0u, (uint32_t) -1));
+		for (auto const & speciesAndRange : this->targetRanges) {
+			auto idx = stamina::core::vectormap::IndexableBitVector<uint32_t>::indexFromString(speciesAndRange.first);
+			if (idx >= 0) {
+				ranges[idx] = speciesAndRange.second;
+			}
+		}
+		return ranges;
+	}
 };
 
 void doPreprocessing();
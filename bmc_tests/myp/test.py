@@ -12,9 +12,10 @@ crnFile, inputFile, propertiesFile, maxStatesToExplore = sys.argv[1::]
 maxStatesToExplore = int(maxStatesToExplore)
 
 # do the yices stuff
-speciesList = bounds.get_bounds(crnFile)
+speciesList, speciesRanges = bounds.get_bounds(crnFile, with_ranges=True)
 
 s = pypmctrie.Settings(speciesList, inputFile, propertiesFile, maxStatesToExplore)
+s.speciesBounds = speciesRanges
 
 pypmctrie.doExploration(s)
 
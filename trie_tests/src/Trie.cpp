@@ -67,6 +67,38 @@ Trie::insert(IndexableBitVector<uint32_t> stateVector, uint16_t pos) {
 
 }
 
+std::pair<uint32_t, bool>
+Trie::findOrInsert(IndexableBitVector<uint32_t> stateVector, uint16_t pos) {
+
+	assert(pos < stateVector.length());
+
+	uint32_t nextIndex = this->max_index;
+	auto result = this->findOrInsert(stateVector, pos, nextIndex);
+	this->max_index = nextIndex;
+	return result;
+}
+
+// The leaf reached after the last species holds the index of the state
+std::pair<uint32_t, bool>
+Trie::findOrInsert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos, uint32_t & nextIndex) {
+
+	// emplace() does the lookup and the insertion with a single search
+	auto found = this->children.emplace(stateVector[pos], nullptr);
+	std::shared_ptr<Trie> & child = found.first->second;
+	if (found.second) {
+		child = std::make_shared<Trie>(nextIndex, nextIndex);
+	}
+
+	if (stateVector.length() - 1 == pos) {
+		if (found.second) {
+			++nextIndex;
+		}
+		return std::make_pair(child->index, found.second);
+	}
+
+	return child->findOrInsert(stateVector, pos + 1, nextIndex);
+}
+
 void
 Trie::printChildren() {
 	std::map<uint32_t, std::shared_ptr<Trie>>::iterator iter = this->children.begin();
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <memory>
+#include <utility>
 #include <vector>
 #include "IndexableBitVector.h"
 #include <boost/container/flat_set.hpp>
@@ -20,9 +21,19 @@ namespace stamina {
 					uint32_t get(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
 					bool contains(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
 					uint32_t insert(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
+					/**
+					 * Looks up a state and inserts it if it is not stored yet, walking
+					 * the trie only once.
+					 *
+					 * @param stateVector State to look up
+					 * @param pos First species of the state to use
+					 * @return The index of the state and whether it was newly inserted
+					 * */
+					std::pair<uint32_t, bool> findOrInsert(IndexableBitVector<uint32_t> stateVector, uint16_t pos = 0);
 					uint32_t getNumberOfStates();
 			
 				private:
+					std::pair<uint32_t, bool> findOrInsert(const IndexableBitVector<uint32_t> & stateVector, uint16_t pos, uint32_t & nextIndex);
 					uint32_t index;
 					std::map<uint32_t, std::shared_ptr<Trie>> children;
 					uint32_t max_index;
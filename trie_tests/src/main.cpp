@@ -118,20 +118,19 @@ int main(int argc, char ** argv) {
 
 		
 
-		// Measure lookup time here. If using Storm's bit vector hashmap
-		// you should pass that in instead of idxableState
+		// Measure lookup time here. The lookup and the insertion of a new
+		// state happen in the same walk down the trie, so for new states
+		// this time is recorded as both a lookup and an insertion.
 		auto startTime = std::chrono::high_resolution_clock::now();
-		bool stateExists = stateStorage.contains(idxableState, 0);
+		auto indexAndInserted = stateStorage.findOrInsert(idxableState, 0);
 		auto lookupTime = std::chrono::high_resolution_clock::now() - startTime;
 
+		bool stateExists = !indexAndInserted.second;
 		// Store this lookup time in our vector
-		// Note that some datastructures may not provide a `contains` function, 
-		// and instead you can tell if it's in the set by the `get()` being equal
-		// to the `end()` function or not.
 		lookupTimes.push_back(LookupTime(lookupTime, stateCnt, stateExists));
 		// If lookup was successful, we don't need to go any further
 		if (stateExists) {
-			return stateStorage.get(idxableState, 0);
+			return indexAndInserted.first;
 		}
 		// This could be encoded in an invariant if in Rust or dafny
 		// assert(stateStorage.getNumberOfStates() == stateCnt);
@@ -140,17 +139,12 @@ int main(int argc, char ** argv) {
 		explorationQueue.push_back(state);
 
 		uint32_t idx = stateCnt++;
-	
-		// Time insertion
-		startTime = std::chrono::high_resolution_clock::now();
-		uint32_t newStateIndex = stateStorage.insert(idxableState, 0) - 1;
-		auto insertTime = std::chrono::high_resolution_clock::now() - startTime;
 
 		// Store our insertion times in the vector defined above
-		insertTimes.push_back(InsertTime(insertTime, stateCnt));
-		
-		assert(idx == newStateIndex);
-		std::cout << "idx=" << idx << ", newStateIndex=" << newStateIndex << std::endl;
+		insertTimes.push_back(InsertTime(lookupTime, stateCnt));
+
+		assert(idx == indexAndInserted.first);
+		std::cout << "idx=" << idx << ", newStateIndex=" << indexAndInserted.first << std::endl;
 		// If not in the state storage, return the last value of stateCnt
 		return idx;
 	});